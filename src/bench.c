@@ -0,0 +1,101 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "kbd.h"
+#include "kbd_layout.h"
+#include "pool.h"
+
+// kbdscr-bench measures how long it takes to render every row of each built-in
+// layout with different numbers of render workers (i.e., KBDSCR_THREADS), so
+// the speedup can be compared on a particular machine. It renders into memory,
+// so it doesn't need an X server or input devices.
+
+// BENCH_SCALES are alternated between for each frame, since every row is only
+// rendered again when the scale changes (like when resizing the window).
+#define BENCH_SCALES 2.0, 2.25
+
+static const struct {
+    kbd_layout_t layout;
+    const char   *id;
+} layouts[] = {
+    #define X(layout, id, desc) {layout, id},
+        KBD_LAYOUTS
+    #undef X
+};
+
+static double bench_clock_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000.0 + ts.tv_nsec/1000000.0;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 3 || (argc > 1 && (!strcmp(argv[1], "-h") || !strcmp(argv[1], "--help")))) {
+        fprintf(stderr, "Usage: %s [max_threads [frames]]\n", argv[0]);
+        fprintf(stderr, "The default is one less than the number of processors, and 100 frames.\n");
+        return EXIT_SUCCESS;
+    }
+
+    long max_threads = argc > 1 ? strtol(argv[1], NULL, 10) : sysconf(_SC_NPROCESSORS_ONLN) - 1;
+    long frames = argc > 2 ? strtol(argv[2], NULL, 10) : 100;
+    if (max_threads < 0 || frames < 1) {
+        fprintf(stderr, "Error: invalid arguments.\n");
+        return EXIT_FAILURE;
+    }
+
+    const double scales[] = {BENCH_SCALES};
+    const size_t n_scales = sizeof(scales)/sizeof(*scales);
+
+    printf("%-16s %7s %10s %10s %8s\n", "layout", "threads", "mean ms", "min ms", "speedup");
+    for (size_t l = 0; l < sizeof(layouts)/sizeof(*layouts); l++) {
+        double base = 0;
+        for (long n_threads = 0; n_threads <= max_threads; n_threads++) {
+            char *err;
+            kbd_t *kbd = kbd_new(layouts[l].layout, &err);
+            if (err) {
+                fprintf(stderr, "Error: initialize keyboard layout %s: %s.\n", layouts[l].id, err);
+                free(err);
+                return EXIT_FAILURE;
+            }
+
+            pool_t *p = NULL;
+            if (n_threads) {
+                p = pool_new(n_threads, &err);
+                if (err) {
+                    fprintf(stderr, "Error: start render workers: %s.\n", err);
+                    free(err);
+                    kbd_free(kbd);
+                    return EXIT_FAILURE;
+                }
+                kbd_set_pool(kbd, p);
+            }
+
+            // the first frame (which also allocates the surfaces) isn't counted
+            double total = 0, min = INFINITY;
+            for (long i = 0; i <= frames; i++) {
+                double scale = scales[i%n_scales];
+                double t = bench_clock_ms();
+                kbd_prepare(kbd, round(kbd_get_width(kbd)*scale), round(kbd_get_height(kbd)*scale));
+                t = bench_clock_ms() - t;
+                if (i) {
+                    total += t;
+                    min = fmin(min, t);
+                }
+            }
+
+            double mean = total/frames;
+            if (!n_threads)
+                base = mean;
+            printf("%-16s %7ld %10.2f %10.2f %7.2fx\n", layouts[l].id, n_threads, mean, min, base/mean);
+
+            kbd_free(kbd);
+            if (p)
+                pool_free(p);
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,246 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "ctl.h"
+
+#define CTL_MAX_CLIENTS 8   // more connections than this are rejected
+#define CTL_MAX_LINE    256 // longer commands are rejected
+
+typedef struct {
+    int    fd; // -1 if unused
+    size_t n;
+    char   buf[CTL_MAX_LINE];
+} ctl_client_t;
+
+struct ctl_t {
+    int          cancel_fd;
+    int          sock_fd;
+    pthread_t    thread;
+    char         *path;
+    const char   *(*cmd_cb)(void *data, const char *cmd);
+    void         (*error_cb)(void *data, const char *err);
+    void         *data;
+    ctl_client_t clients[CTL_MAX_CLIENTS];
+};
+
+static void *ctl_thread(ctl_t *c);
+
+ctl_t *ctl_start(const char *path, const char *(*cmd_cb)(void *data, const char *cmd), void (*error_cb)(void *data, const char *err), void *data, char **err) {
+    #define ctl_start_err(format, ...) do {           \
+        if (err)                                      \
+            asprintf(err, format, ##__VA_ARGS__);     \
+        if (c->sock_fd != -1)                         \
+            close(c->sock_fd);                        \
+        if (c->cancel_fd != -1)                       \
+            close(c->cancel_fd);                      \
+        free(c->path);                                \
+        free(c);                                      \
+        return NULL;                                  \
+    } while (0)
+
+    ctl_t *c = calloc(1, sizeof(ctl_t));
+    c->cancel_fd = -1;
+    c->sock_fd   = -1;
+    c->path      = strdup(path);
+    c->cmd_cb    = cmd_cb;
+    c->error_cb  = error_cb;
+    c->data      = data;
+    for (size_t i = 0; i < CTL_MAX_CLIENTS; i++)
+        c->clients[i].fd = -1;
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path))
+        ctl_start_err("socket path too long (%zu > %zu)", strlen(path), sizeof(addr.sun_path) - 1);
+    strcpy(addr.sun_path, path);
+
+    // a socket left over from a previous instance which didn't exit cleanly
+    // would prevent binding, but one which something is still listening on
+    // (or anything else) must be left alone
+    struct stat st;
+    if (!lstat(path, &st)) {
+        if (!S_ISSOCK(st.st_mode))
+            ctl_start_err("'%s' already exists and is not a socket", path);
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd == -1)
+            ctl_start_err("create socket: %s", strerror(errno));
+        int r = connect(fd, (struct sockaddr*)(&addr), sizeof(addr)), e = errno;
+        close(fd);
+        if (!r)
+            ctl_start_err("'%s' is already in use", path);
+        if (e != ECONNREFUSED)
+            ctl_start_err("check whether '%s' is in use: %s", path, strerror(e));
+        if (unlink(path))
+            ctl_start_err("remove stale socket '%s': %s", path, strerror(errno));
+    }
+
+    if ((c->sock_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1)
+        ctl_start_err("create socket: %s", strerror(errno));
+    if (bind(c->sock_fd, (struct sockaddr*)(&addr), sizeof(addr)))
+        ctl_start_err("bind socket to '%s': %s", path, strerror(errno));
+    if (listen(c->sock_fd, CTL_MAX_CLIENTS))
+        ctl_start_err("listen on socket: %s", strerror(errno));
+
+    if ((c->cancel_fd = eventfd(0, EFD_CLOEXEC)) == -1)
+        ctl_start_err("could not create cancellation eventfd: %s", strerror(errno));
+
+    if (pthread_create(&c->thread, NULL, (void*(*)(void*))(ctl_thread), c) != 0)
+        ctl_start_err("could not start thread");
+
+    if (err)
+        *err = NULL;
+    return c;
+
+    #undef ctl_start_err
+}
+
+void ctl_stop(ctl_t *c) {
+    uint64_t i = 1;
+    assert(write(c->cancel_fd, &i, sizeof(i)) == sizeof(i));
+    pthread_join(c->thread, NULL); // wait for the connections to be closed
+    close(c->cancel_fd);
+    close(c->sock_fd);
+    unlink(c->path);
+    free(c->path);
+    free(c);
+}
+
+// ctl_client_read reads everything available from a client and runs each
+// complete line. It returns false if the connection should be closed.
+static bool ctl_client_read(ctl_t *c, ctl_client_t *cl) {
+    ssize_t n = read(cl->fd, cl->buf + cl->n, sizeof(cl->buf) - cl->n);
+    if (n <= 0)
+        return n == -1 && (errno == EINTR || errno == EAGAIN);
+    cl->n += n;
+
+    char *line = cl->buf, *end;
+    while ((end = memchr(line, '\n', cl->buf + cl->n - line))) {
+        *end = '\0';
+        if (end > line && end[-1] == '\r')
+            end[-1] = '\0';
+
+        const char *msg = c->cmd_cb(c->data, line);
+        char reply[CTL_MAX_LINE];
+        int r = msg
+            ? snprintf(reply, sizeof(reply), "error: %s\n", msg)
+            : snprintf(reply, sizeof(reply), "ok\n");
+        if (r >= (int)(sizeof(reply)))
+            r = sizeof(reply) - 1;
+        if (send(cl->fd, reply, r, MSG_NOSIGNAL) != r)
+            return false;
+
+        line = end + 1;
+    }
+
+    cl->n -= line - cl->buf;
+    memmove(cl->buf, line, cl->n);
+    if (cl->n == sizeof(cl->buf)) {
+        send(cl->fd, "error: command too long\n", 24, MSG_NOSIGNAL);
+        return false;
+    }
+    return true;
+}
+
+static void *ctl_thread(ctl_t *c) {
+    #define ctl_err(format, ...) do {              \
+        if (c->error_cb) {                         \
+            char *msg;                             \
+            asprintf(&msg, format, ##__VA_ARGS__); \
+            c->error_cb(c->data, msg);             \
+            free(msg);                             \
+        }                                          \
+    } while (0)
+
+    int efd;
+    if ((efd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+        ctl_err("create epoll fd: %s", strerror(errno));
+        return NULL;
+    }
+
+    if (epoll_ctl(efd, EPOLL_CTL_ADD, c->cancel_fd, &(struct epoll_event){
+        .data   = { .u32 = 0xFFFFFFFF },
+        .events = EPOLLIN,
+    })) {
+        ctl_err("add cancellation eventfd to epoll: %s", strerror(errno));
+        close(efd);
+        return NULL;
+    }
+
+    if (epoll_ctl(efd, EPOLL_CTL_ADD, c->sock_fd, &(struct epoll_event){
+        .data   = { .u32 = 0xFFFFFFFE },
+        .events = EPOLLIN,
+    })) {
+        ctl_err("add socket to epoll: %s", strerror(errno));
+        close(efd);
+        return NULL;
+    }
+
+    int n, fd;
+    struct epoll_event events[CTL_MAX_CLIENTS + 2];
+    for (;;) {
+        if ((n = epoll_wait(efd, events, sizeof(events) / sizeof(events[0]), -1)) == -1) {
+            if (errno != EINTR)
+                ctl_err("wait for epoll event: %s", strerror(errno));
+            continue;
+        }
+
+        for (int i = 0; i < n; i++)
+            if (events[i].data.u32 == 0xFFFFFFFF)
+                goto cancel;
+
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.u32 == 0xFFFFFFFE) {
+                if ((fd = accept4(c->sock_fd, NULL, NULL, SOCK_CLOEXEC)) == -1) {
+                    ctl_err("accept connection: %s", strerror(errno));
+                    continue;
+                }
+                size_t j = 0;
+                while (j < CTL_MAX_CLIENTS && c->clients[j].fd != -1)
+                    j++;
+                if (j == CTL_MAX_CLIENTS) {
+                    send(fd, "error: too many connections\n", 28, MSG_NOSIGNAL);
+                    close(fd);
+                    continue;
+                }
+                if (epoll_ctl(efd, EPOLL_CTL_ADD, fd, &(struct epoll_event){
+                    .data   = { .u32 = j },
+                    .events = EPOLLIN,
+                })) {
+                    ctl_err("add connection to epoll: %s", strerror(errno));
+                    close(fd);
+                    continue;
+                }
+                c->clients[j] = (ctl_client_t){ .fd = fd };
+                continue;
+            }
+
+            ctl_client_t *cl = &c->clients[events[i].data.u32];
+            if (cl->fd != -1 && !ctl_client_read(c, cl)) {
+                close(cl->fd); // also removes it from the epoll
+                cl->fd = -1;
+            }
+        }
+    }
+
+cancel:
+    for (size_t i = 0; i < CTL_MAX_CLIENTS; i++)
+        if (c->clients[i].fd != -1)
+            close(c->clients[i].fd);
+    close(efd);
+    return NULL;
+
+    #undef ctl_err
+}
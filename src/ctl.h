@@ -0,0 +1,25 @@
+#ifndef KBDSCR_CTL_H
+#define KBDSCR_CTL_H
+
+// ctl_t is a unix socket which accepts line-based commands.
+typedef struct ctl_t ctl_t;
+
+// ctl_start creates a unix stream socket at path (replacing a stale socket
+// which nothing is listening on, but nothing else), and starts a new thread
+// which accepts connections on it and calls cmd_cb with each line received
+// (without the newline). The callback returns NULL if the command succeeded, or
+// a string describing why it didn't, and the client is sent "ok" or "error: "
+// followed by that string. If any errors ocurred, the return value will be
+// NULL, and if err is not NULL, its target will be set to a string describing
+// the error (which will need to be freed by the caller). Otherwise, the return
+// value will be an allocated ctl_t.
+ctl_t *ctl_start(
+    const char *path,
+    const char *(*cmd_cb)(void *data, const char *cmd),
+    void (*error_cb)(void *data, const char *err),
+    void *data, char **err);
+
+// ctl_stop stops the thread, closes the connections, and removes the socket.
+void ctl_stop(ctl_t *c);
+
+#endif
@@ -2,6 +2,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -16,24 +17,40 @@
 #include "evdev.h"
 
 struct evdev_watch_key_t {
-    int        cancel_fd;
-    pthread_t  thread;
-    void       (*keystate_cb)(void* data, int code, int state);
-    void       (*error_cb)(void* data, const char* err);
-    void       *data;
-    size_t     n_dev;
-    const char **devs;
+    int                    cancel_fd;
+    pthread_t              thread;
+    size_t                 n_sinks;
+    evdev_watch_key_sink_t sinks[EVDEV_WATCH_KEY_MAX_SINKS];
+    uint64_t               dispatch[KEY_CNT]; // the sinks (as a bitmask of indexes) which have each KEY_* or BTN_*
+    void                   (*error_cb)(void* data, const char* err);
+    void                   *data;
+    size_t                 n_dev;
+    const char             **devs;
 };
 
 static void *evdev_watch_key_thread(evdev_watch_key_t *opts);
 
-evdev_watch_key_t *evdev_watch_key_start(void (*keystate_cb)(void* data, int code, int state), void (*error_cb)(void* data, const char* err), void *data, const char **devs, size_t n_dev, char **err) {
+evdev_watch_key_t *evdev_watch_key_start(const evdev_watch_key_sink_t *sinks, size_t n_sinks, void (*error_cb)(void* data, const char* err), void *data, const char **devs, size_t n_dev, char **err) {
+    if (n_sinks > EVDEV_WATCH_KEY_MAX_SINKS) {
+        if (err)
+            asprintf(err, "too many sinks (%zu > %d)", n_sinks, EVDEV_WATCH_KEY_MAX_SINKS);
+        return NULL;
+    }
+
     evdev_watch_key_t *w = calloc(1, sizeof(evdev_watch_key_t));
-    w->keystate_cb = keystate_cb;
-    w->error_cb    = error_cb;
-    w->data        = data;
-    w->n_dev       = n_dev;
-    w->devs        = devs;
+    w->n_sinks  = n_sinks;
+    w->error_cb = error_cb;
+    w->data     = data;
+    w->n_dev    = n_dev;
+    w->devs     = devs;
+
+    // the table is built up-front so the watcher only needs a single lookup to
+    // find which sinks to call for each event
+    memcpy(w->sinks, sinks, n_sinks * sizeof(evdev_watch_key_sink_t));
+    for (size_t i = 0; i < n_sinks; i++)
+        for (int code = 0; code < KEY_CNT; code++)
+            if (!sinks[i].has_key_cb || sinks[i].has_key_cb(sinks[i].data, code))
+                w->dispatch[code] |= (uint64_t)(1) << i;
 
     if ((w->cancel_fd = eventfd(0, 0)) == -1) {
         if (err)
@@ -101,6 +118,7 @@ static void *evdev_watch_key_thread(evdev_watch_key_t *w) {
 
     int n;
     struct epoll_event events[10]; // an arbitrary limit
+    struct input_event evs[64];    // also arbitrary, but a bit more than a typical SYN_REPORT
     for (;;) {
         if ((n = epoll_wait(efd, events, sizeof(events) / sizeof(events[0]), -1)) == -1) {
             evdev_watch_key_err("wait for epoll event: %s", strerror(errno));
@@ -111,9 +129,14 @@ static void *evdev_watch_key_thread(evdev_watch_key_t *w) {
             if (events[i].data.u32 == 0xFFFFFFFF)
                 goto cancel;
 
+        // relative motion is summed over everything read in this iteration, so
+        // high-rate mice (which can send thousands of events per second) only
+        // result in a single callback per wakeup
+        int rel[4] = {0}; // REL_X, REL_Y, REL_WHEEL, REL_HWHEEL
+
         for (int i = 0; i < n; i++) {
             int fd = fds[events[i].data.u32];
-            const char* dev = w->devs[i];
+            const char* dev = w->devs[events[i].data.u32];
 
             if (events[i].events & EPOLLHUP) {
                 evdev_watch_key_err("handle epoll event (fd: %d, dev: %s): EPOLLHUP, removing fd from epoll", fd, dev);
@@ -130,19 +153,42 @@ static void *evdev_watch_key_thread(evdev_watch_key_t *w) {
                 continue;
             }
 
+            // evdev only returns whole events
             int m;
-            struct input_event ev;
-            if ((m = read(fd, &ev, sizeof(ev))) == -1) {
+            if ((m = read(fd, evs, sizeof(evs))) == -1) {
                 evdev_watch_key_err("handle epoll event (fd: %d, dev: %s): read evdev event struct: %s", fd, dev, strerror(errno));
                 continue;
-            } else if (m != sizeof(ev)) {
-                evdev_watch_key_err("handle epoll event (fd: %d, dev: %s): read evdev event struct: wrong size: wanted %zu, got %d", fd, dev, sizeof(ev), m);
+            } else if (m % sizeof(*evs)) {
+                evdev_watch_key_err("handle epoll event (fd: %d, dev: %s): read evdev event struct: wrong size: wanted a multiple of %zu, got %d", fd, dev, sizeof(*evs), m);
                 continue;
             }
 
-            if (ev.type == EV_KEY && w->keystate_cb)
-                w->keystate_cb(w->data, ev.code, ev.value);
+            for (struct input_event *ev = evs; ev < evs + m/sizeof(*evs); ev++) {
+                switch (ev->type) {
+                case EV_KEY:
+                    if (ev->code >= KEY_CNT)
+                        break;
+                    for (uint64_t mask = w->dispatch[ev->code]; mask; mask &= mask - 1) {
+                        evdev_watch_key_sink_t *s = &w->sinks[__builtin_ctzll(mask)];
+                        s->keystate_cb(s->data, ev->code, ev->value);
+                    }
+                    break;
+                case EV_REL:
+                    switch (ev->code) {
+                    case REL_X:      rel[0] += ev->value; break;
+                    case REL_Y:      rel[1] += ev->value; break;
+                    case REL_WHEEL:  rel[2] += ev->value; break;
+                    case REL_HWHEEL: rel[3] += ev->value; break;
+                    }
+                    break;
+                }
+            }
         }
+
+        if (rel[0] || rel[1] || rel[2] || rel[3])
+            for (size_t i = 0; i < w->n_sinks; i++)
+                if (w->sinks[i].rel_cb)
+                    w->sinks[i].rel_cb(w->sinks[i].data, rel[0], rel[1], rel[2], rel[3]);
     }
 
 cancel:
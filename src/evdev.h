@@ -1,14 +1,30 @@
 #ifndef KBDSCR_EVDEV_H
 #define KBDSCR_EVDEV_H
+#include <stdbool.h>
 #include <stddef.h>
 #include "kbd.h"
 
 typedef struct evdev_watch_key_t evdev_watch_key_t;
 
+// EVDEV_WATCH_KEY_MAX_SINKS is the maximum number of sinks for a single
+// evdev_watch_key_t.
+#define EVDEV_WATCH_KEY_MAX_SINKS 64
+
+// evdev_watch_key_sink_t receives key events from an evdev_watch_key_t.
+typedef struct {
+    void (*keystate_cb)(void* data, int code, int state);
+    bool (*has_key_cb)(void* data, int code); // if NULL, the sink receives all codes
+    void (*rel_cb)(void* data, int dx, int dy, int wheel, int hwheel); // if NULL, the sink doesn't receive relative motion
+    void *data;
+} evdev_watch_key_sink_t;
+
 // evdev_watch_key starts a new thread which watches the provided evdev devices
-// and calls keystate_cb for each key event.
+// and calls keystate_cb for each key event on the sinks which have the key. The
+// sinks are copied, and has_key_cb is only called before this returns. The
+// relative motion (REL_X, REL_Y, REL_WHEEL, and REL_HWHEEL) from all devices is
+// summed over all events which are ready at once, then passed to rel_cb.
 evdev_watch_key_t *evdev_watch_key_start(
-    void (*keystate_cb)(void* data, int code, int state),
+    const evdev_watch_key_sink_t *sinks, size_t n_sinks,
     void (*error_cb)(void* data, const char* err),
     void *data,
     const char **devs, size_t n_dev,
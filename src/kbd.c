@@ -1,23 +1,80 @@
 #define _GNU_SOURCE
 #include <assert.h>
+#include <math.h>
 #include <stdatomic.h>
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <cairo/cairo.h>
 #include <linux/input-event-codes.h>
 
 #include "kbd.h"
+#include "pool.h"
+
+// KBD_REL_HOLD_MS is how long the motion indicators are shown for after the last
+// motion, so they don't flicker between events.
+#define KBD_REL_HOLD_MS 150
+
+// KBD_HEAT_LEVELS is the number of shades the heatmap is quantized to, each of
+// which is rasterized once per band (when first used) like the key states.
+#define KBD_HEAT_LEVELS 8
+
+// KBD_HEAT_RANGE_STEP is what the heatmap range (the log1p of the counter of the
+// most used key) is rounded up to a multiple of, so using that key doesn't
+// change the shade of every other key each time.
+#define KBD_HEAT_RANGE_STEP 0.5
+
+// kbd_rect_t is the position of a key in pixels at a scale of 1.
+typedef struct {
+    int x, y, w, h;
+} kbd_rect_t;
+
+// kbd_band_t is a row of the keyboard, which is rasterized separately from the
+// others so only the rows which changed need to be redrawn, and so multiple
+// rows can be redrawn in parallel.
+typedef struct {
+    double          y0, y1;                 // the extent of the band at a scale of 1 (split in the middle of the gaps between rows)
+    size_t          key0, key1;             // the keys in the band (layout.keys[key0] to layout.keys[key1-1])
+    double          scale;                  // the scale the surfaces were rendered at, or 0 if they haven't been rendered yet
+    int             dy, h;                  // the extent of the band in pixels at scale
+    cairo_surface_t *cache[3];              // the band with every key in each state (UP, DOWN, HOLD)
+    cairo_surface_t *heat[KBD_HEAT_LEVELS]; // the band with every key UP and tinted for each heatmap level, or NULL if not used yet
+    cairo_surface_t *frame;                 // the band with each key in drawn_state
+} kbd_band_t;
 
 struct kbd_t {
-    kbd_layout_t layout;
-    atomic_int   state[KEY_CNT]; // each item is the last evdev key event value (0=UP, 1=DOWN, 2=HOLD) for each KEY_* and BTN_*
-    void         (*redraw_cb)(void*);
-    void         *redraw_cb_data;
+    kbd_layout_t    layout;
+    kbd_rect_t      *geom;          // the position of each key in layout.keys
+    atomic_int      state[KEY_CNT]; // each item is the last evdev key event value (0=UP, 1=DOWN, 2=HOLD) for each KEY_* and BTN_*
+    void            (*redraw_cb)(void*);
+    void            *redraw_cb_data;
+    kbd_usage_t     *usage;
+    int             heatmap;        // KBD_HEATMAP_*
+    bool            timing;
+    pool_t          *pool;
+    size_t          n_bands;
+    kbd_band_t      *bands;
+    size_t          *dirty;         // the bands to render for the current frame
+    double          scale;          // the scale of the last frame
+    int             *drawn_state;   // the state of each key in layout.keys in the last frame
+    int             *drawn_heat;    // the heatmap level (0 to KBD_HEAT_LEVELS) of each key in layout.keys in the last frame (if heatmap)
+    atomic_int      rel[2][2];      // the motion and wheel accumulated since the last frame, as KBD_KEY_REL_* (dx, dy)
+    atomic_bool     rel_pending;    // whether redraw_cb has been called since the last frame for rel
+    int             drawn_rel[2][2]; // the motion and wheel shown in the last frame
+    int64_t         drawn_rel_until[2]; // when to stop showing drawn_rel, or 0
 };
 
+static inline int kbd_get_px_per_unit(kbd_t *kbd) { return kbd->layout.px_per_base / kbd->layout.units_per_base; }
+static inline int kbd_get_gap(kbd_t *kbd)         { return kbd_get_px_per_unit(kbd); }
+static inline int kbd_get_padding(kbd_t *kbd)     { return kbd->layout.px_per_base/8; }
+static inline int kbd_get_font_size(kbd_t *kbd)   { return kbd->layout.px_per_base/2; }
+static inline int kbd_get_curve(kbd_t *kbd)       { return kbd->layout.px_per_base/2; }
+
 kbd_t *kbd_new(kbd_layout_t layout, char **err) {
     #define kbd_new_assert(cond, format, ...) do {    \
         if (!(cond)) {                                \
@@ -36,20 +93,46 @@ kbd_t *kbd_new(kbd_layout_t layout, char **err) {
     kbd_new_assert(kbd->layout.px_per_base%kbd->layout.units_per_base == 0, "pixels per base (%d) must divide into units per base (%d) without any remainder for layout to work correctly (to prevent rounding issues and blurriness in cell layout)", kbd->layout.px_per_base, kbd->layout.units_per_base);
     kbd_new_assert(kbd->layout.px_per_base%8 == 0, "pixels per base (%d) must be divisible by 8 for layout to work correctly (e.g. font size is /2, padding is /8)", kbd->layout.px_per_base);
 
-    int n = 0;
+    kbd->geom = calloc(kbd->layout.n_keys, sizeof(kbd_rect_t));
+    kbd->drawn_state = calloc(kbd->layout.n_keys, sizeof(int));
+    kbd->drawn_heat = calloc(kbd->layout.n_keys, sizeof(int));
+    kbd->bands = calloc(kbd->layout.n_keys, sizeof(kbd_band_t)); // there can't be more rows than keys
+    kbd->dirty = calloc(kbd->layout.n_keys, sizeof(size_t));
+
+    int n = 0, r = 0;
     for (size_t i = 0; i < kbd->layout.n_keys; i++) {
         kbd_layout_key_t *key = &kbd->layout.keys[i];
         int dn = key->units;
         kbd_new_assert(dn > 0, "key %zu: must be 1 or more units wide, is %d", i, dn);
         kbd_new_assert(dn <= kbd->layout.units_per_row, "key %zu: must fit in %d units, is %d", i, kbd->layout.units_per_row, dn);
         kbd_new_assert(dn <= (kbd->layout.units_per_row-n), "key %zu: too large for remaining space in row, wanted %d units, %d used, %d available", i, dn, n, kbd->layout.units_per_row-n);
+        kbd_new_assert(!key->label || (key->code > 0 && key->code <= KBD_KEY_REL_WHEEL), "key %zu: invalid code %d", i, key->code);
+        kbd->geom[i] = (kbd_rect_t){
+            .x = kbd_get_gap(kbd) + n*kbd_get_px_per_unit(kbd),
+            .y = kbd_get_gap(kbd) + r*(kbd->layout.px_per_base + kbd_get_gap(kbd)),
+            .w = dn*kbd_get_px_per_unit(kbd),
+            .h = kbd->layout.px_per_base,
+        };
+        if (n == 0) {
+            kbd->bands[r].key0 = i;
+            kbd->bands[r].y0 = r ? kbd->geom[i].y - kbd_get_gap(kbd)/2.0 : 0;
+            if (r)
+                kbd->bands[r-1].y1 = kbd->bands[r].y0;
+        }
         n += dn;
         assert(n <= kbd->layout.units_per_row);
-        if (n == kbd->layout.units_per_row)
+        if (n == kbd->layout.units_per_row) {
+            kbd->bands[r].key1 = i + 1;
             n = 0;
+            r++;
+        }
     }
     kbd_new_assert(n == 0, "expected more keys to fill row, got none, %d units missing", kbd->layout.units_per_row-n);
 
+    kbd->n_bands = r;
+    if (r)
+        kbd->bands[r-1].y1 = kbd_get_height(kbd);
+
     if (err)
         *err = NULL;
     return kbd;
@@ -58,6 +141,21 @@ kbd_t *kbd_new(kbd_layout_t layout, char **err) {
 }
 
 void kbd_free(kbd_t *kbd) {
+    for (size_t i = 0; i < kbd->n_bands; i++) {
+        for (int j = 0; j < 3; j++)
+            if (kbd->bands[i].cache[j])
+                cairo_surface_destroy(kbd->bands[i].cache[j]);
+        for (int j = 0; j < KBD_HEAT_LEVELS; j++)
+            if (kbd->bands[i].heat[j])
+                cairo_surface_destroy(kbd->bands[i].heat[j]);
+        if (kbd->bands[i].frame)
+            cairo_surface_destroy(kbd->bands[i].frame);
+    }
+    free(kbd->geom);
+    free(kbd->drawn_state);
+    free(kbd->drawn_heat);
+    free(kbd->bands);
+    free(kbd->dirty);
     free(kbd);
 }
 
@@ -66,6 +164,26 @@ void kbd_set_redraw_cb(kbd_t *kbd, void (*fn)(void*), void* data) {
     kbd->redraw_cb_data = data;
 }
 
+void kbd_set_pool(kbd_t *kbd, pool_t *pool) {
+    kbd->pool = pool;
+}
+
+void kbd_set_timing(kbd_t *kbd, bool timing) {
+    kbd->timing = timing;
+}
+
+void kbd_set_usage(kbd_t *kbd, kbd_usage_t *usage, int heatmap) {
+    kbd->usage = usage;
+    kbd->heatmap = usage ? heatmap : KBD_HEATMAP_NONE;
+}
+
+// kbd_get_heat gets the usage counter of a KEY_* or BTN_* for the heatmap.
+static inline uint64_t kbd_get_heat(kbd_t *kbd, int key) {
+    return kbd->heatmap == KBD_HEATMAP_HELD
+        ? kbd_usage_get_held_ms(kbd->usage, key)
+        : kbd_usage_get_presses(kbd->usage, key);
+}
+
 static inline int kbd_get_state(kbd_t *kbd, int key) {
     assert(key > 0 && key <= KEY_MAX);
     return atomic_load(&kbd->state[key]);
@@ -74,15 +192,30 @@ static inline int kbd_get_state(kbd_t *kbd, int key) {
 void kbd_set_state(kbd_t *kbd, int key, int state) {
     int old = kbd_get_state(kbd, key);
     while (!atomic_compare_exchange_strong(&kbd->state[key], &old, state));
+    if (old != state && kbd->usage)
+        kbd_usage_record(kbd->usage, key, old, state);
     if (old != state && kbd->redraw_cb)
         kbd->redraw_cb(kbd->redraw_cb_data);
 }
 
-static inline int kbd_get_px_per_unit(kbd_t *kbd) { return kbd->layout.px_per_base / kbd->layout.units_per_base; }
-static inline int kbd_get_gap(kbd_t *kbd)         { return kbd_get_px_per_unit(kbd); }
-static inline int kbd_get_padding(kbd_t *kbd)     { return kbd->layout.px_per_base/8; }
-static inline int kbd_get_font_size(kbd_t *kbd)   { return kbd->layout.px_per_base/2; }
-static inline int kbd_get_curve(kbd_t *kbd)       { return kbd->layout.px_per_base/2; }
+void kbd_add_rel(kbd_t *kbd, int dx, int dy, int wheel, int hwheel) {
+    // stored as screen directions (REL_WHEEL is positive when scrolling up)
+    int v[2][2] = {{dx, dy}, {hwheel, -wheel}};
+    for (int i = 0; i < 2; i++)
+        for (int j = 0; j < 2; j++)
+            if (v[i][j])
+                atomic_fetch_add_explicit(&kbd->rel[i][j], v[i][j], memory_order_relaxed);
+    // coalesce the redraws until the next frame takes the accumulated values
+    if (!atomic_exchange(&kbd->rel_pending, true) && kbd->redraw_cb)
+        kbd->redraw_cb(kbd->redraw_cb_data);
+}
+
+bool kbd_has_key(kbd_t *kbd, int key) {
+    for (size_t i = 0; i < kbd->layout.n_keys; i++)
+        if (kbd->layout.keys[i].label && kbd->layout.keys[i].code == key)
+            return true;
+    return false;
+}
 
 int kbd_get_rows(kbd_t *kbd) {
     int n = 0;
@@ -96,12 +229,43 @@ int kbd_get_height(kbd_t *kbd) { return kbd_get_gap(kbd) + kbd_get_rows(kbd)*(kb
 
 static void cairoext_rectangle_curved(cairo_t *cr, double x, double y, double w, double h, double r);
 
-void kbd_draw(kbd_t *kbd, cairo_t *cr) {
+static int64_t kbd_clock_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)(ts.tv_sec)*1000 + ts.tv_nsec/1000000;
+}
+
+// kbd_draw_rel draws an arrow from the center of a key in the direction of the
+// motion, with the length scaled logarithmically up to ref.
+static void kbd_draw_rel(kbd_t *kbd, cairo_t *cr, kbd_rect_t *r, int dx, int dy, double ref) {
     #define RGB(r, g, b) (double)(r)/255.0l, (double)(g)/255.0l, (double)(b)/255.0l
 
-    int tw, th;
-    tw = kbd_get_width(kbd);
-    th = kbd_get_height(kbd);
+    double cx = r->x + r->w/2.0, cy = r->y + r->h/2.0;
+    double max = fmin(r->w, r->h)/2.0 - kbd_get_padding(kbd);
+    double len = max * fmin(1, log1p(hypot(dx, dy))/log1p(ref));
+    double a = atan2(dy, dx), hl = max/3, hw = M_PI/6;
+    if (len < hl)
+        len = hl;
+
+    cairo_set_line_width(cr, kbd_get_padding(kbd)/2.0);
+    cairo_set_line_cap(cr, CAIRO_LINE_CAP_ROUND);
+    cairo_set_source_rgba(cr, RGB(128, 64, 64), 0.8);
+
+    cairo_move_to(cr, cx, cy);
+    cairo_line_to(cr, cx + (len - hl/2)*cos(a), cy + (len - hl/2)*sin(a));
+    cairo_stroke(cr);
+
+    cairo_move_to(cr, cx + len*cos(a), cy + len*sin(a));
+    cairo_line_to(cr, cx + len*cos(a) - hl*cos(a - hw), cy + len*sin(a) - hl*sin(a - hw));
+    cairo_line_to(cr, cx + len*cos(a) - hl*cos(a + hw), cy + len*sin(a) - hl*sin(a + hw));
+    cairo_close_path(cr);
+    cairo_fill(cr);
+
+    #undef RGB
+}
+
+static void kbd_draw_layer(kbd_t *kbd, cairo_t *cr, int state, size_t key0, size_t key1) {
+    #define RGB(r, g, b) (double)(r)/255.0l, (double)(g)/255.0l, (double)(b)/255.0l
 
     cairo_set_line_width(cr, 1);
     cairo_set_line_join(cr, CAIRO_LINE_JOIN_MITER);
@@ -111,60 +275,296 @@ void kbd_draw(kbd_t *kbd, cairo_t *cr) {
     cairo_set_font_size(cr, kbd_get_font_size(kbd));
     cairo_font_extents(cr, &ef);
 
-    cairo_rectangle(cr, 0, 0, tw, th);
+    cairo_rectangle(cr, 0, 0, kbd_get_width(kbd), kbd_get_height(kbd));
     cairo_set_source_rgb(cr, RGB(244, 239, 239));
     cairo_fill(cr);
 
-    int cx, cy, cn;
-    cx = kbd_get_gap(kbd);
-    cy = kbd_get_gap(kbd);
-    cn = 0;
+    for (size_t i = key0; i < key1; i++) {
+        kbd_layout_key_t *key = &kbd->layout.keys[i];
+        kbd_rect_t *r = &kbd->geom[i];
+
+        if (!key->label)
+            continue;
 
-    for (size_t i = 0; i < kbd->layout.n_keys; i++) {
+        cairoext_rectangle_curved(cr, r->x, r->y, r->w, r->h, kbd_get_curve(kbd));
+
+        cairo_set_source_rgb(cr, RGB(0, 0, 0));
+        cairo_stroke_preserve(cr);
+
+        switch (state) {
+        case 0: cairo_set_source_rgb(cr, RGB(255, 255, 255)); break; // UP
+        case 1: cairo_set_source_rgb(cr, RGB(214, 194, 194)); break; // DOWN
+        case 2: cairo_set_source_rgb(cr, RGB(194, 163, 163)); break; // HOLD
+        default: assert(0);
+        }
+        cairo_fill(cr);
+
+        cairo_text_extents_t et;
+        cairo_text_extents(cr, key->label, &et);
+        cairo_move_to(cr,
+            r->x + 0.5 + r->w/2 - et.x_bearing - et.width/2,
+            r->y + 0.5 + r->h/2 + kbd_get_padding(kbd) - ef.descent + et.height/2
+        );
+        cairo_set_source_rgb(cr, RGB(0, 0, 0));
+        cairo_show_text(cr, key->label);
+    }
+
+    #undef RGB
+}
+
+// kbd_band_heat gets the band with every key released and tinted for a heatmap
+// level, rasterizing it if it hasn't been used since the scale last changed.
+static cairo_surface_t *kbd_band_heat(kbd_t *kbd, kbd_band_t *b, int level) {
+    cairo_surface_t **s = &b->heat[level-1];
+    if (*s)
+        return *s;
+
+    *s = cairo_image_surface_create(CAIRO_FORMAT_RGB24, round(kbd_get_width(kbd)*b->scale), b->h);
+
+    cairo_t *cr = cairo_create(*s);
+    cairo_set_source_surface(cr, b->cache[0], 0, 0);
+    cairo_paint(cr);
+
+    cairo_translate(cr, 0, -b->dy);
+    cairo_scale(cr, b->scale, b->scale);
+
+    double t = (double)(level)/KBD_HEAT_LEVELS;
+    for (size_t i = b->key0; i < b->key1; i++) {
+        kbd_rect_t *r = &kbd->geom[i];
+        if (!kbd->layout.keys[i].label || kbd->layout.keys[i].code >= KEY_CNT)
+            continue;
+        cairoext_rectangle_curved(cr, r->x, r->y, r->w, r->h, kbd_get_curve(kbd));
+        cairo_set_source_rgba(cr, 1, 0.85 - 0.75*t, 0.2 - 0.2*t, 0.15 + 0.45*t);
+        cairo_fill(cr);
+    }
+
+    cairo_destroy(cr);
+    return *s;
+}
+
+// kbd_band_render renders a band into its frame using the drawn_* fields. If the
+// scale has changed, every key in every state is rasterized again first (this
+// is the only place text and key outlines are actually drawn). Different bands
+// can be rendered concurrently.
+static void kbd_band_render(kbd_t *kbd, kbd_band_t *b) {
+    double scale = kbd->scale;
+    int sw = round(kbd_get_width(kbd)*scale);
+
+    if (b->scale != scale) {
+        b->dy = round(b->y0*scale);
+        b->h = round(b->y1*scale) - b->dy;
+        for (int i = 0; i < 3; i++) {
+            if (b->cache[i])
+                cairo_surface_destroy(b->cache[i]);
+            b->cache[i] = cairo_image_surface_create(CAIRO_FORMAT_RGB24, sw, b->h);
+
+            cairo_t *cr = cairo_create(b->cache[i]);
+            cairo_translate(cr, 0, -b->dy);
+            cairo_scale(cr, scale, scale);
+            kbd_draw_layer(kbd, cr, i, b->key0, b->key1);
+            cairo_destroy(cr);
+        }
+        for (int i = 0; i < KBD_HEAT_LEVELS; i++) {
+            if (b->heat[i])
+                cairo_surface_destroy(b->heat[i]);
+            b->heat[i] = NULL;
+        }
+        if (b->frame)
+            cairo_surface_destroy(b->frame);
+        b->frame = cairo_image_surface_create(CAIRO_FORMAT_RGB24, sw, b->h);
+        b->scale = scale;
+    }
+
+    cairo_t *cr = cairo_create(b->frame);
+
+    cairo_set_source_surface(cr, b->cache[0], 0, 0);
+    cairo_paint(cr);
+
+    // released keys are tinted by the number of times they have been pressed
+    for (size_t i = b->key0; i < b->key1; i++) {
+        kbd_rect_t *r = &kbd->geom[i];
+        int state = kbd->drawn_state[i];
+        int heat = kbd->heatmap ? kbd->drawn_heat[i] : 0;
+        if (!kbd->layout.keys[i].label || (!state && !heat))
+            continue;
+
+        // include the outline, which is centered on the edge of the key
+        cairo_rectangle(cr,
+            floor(r->x*scale) - 1,
+            floor(r->y*scale) - 1 - b->dy,
+            ceil(r->w*scale) + 2,
+            ceil(r->h*scale) + 2
+        );
+        cairo_set_source_surface(cr, state ? b->cache[state] : kbd_band_heat(kbd, b, heat), 0, 0);
+        cairo_fill(cr);
+    }
+
+    cairo_translate(cr, 0, -b->dy);
+    cairo_scale(cr, scale, scale);
+
+    for (size_t i = b->key0; i < b->key1; i++) {
         kbd_layout_key_t *key = &kbd->layout.keys[i];
+        if (!key->label || key->code < KEY_CNT)
+            continue;
+        int *v = kbd->drawn_rel[key->code - KEY_CNT];
+        if (v[0] || v[1])
+            kbd_draw_rel(kbd, cr, &kbd->geom[i], v[0], v[1], key->code == KBD_KEY_REL_MOTION ? 64 : 4);
+    }
 
-        int kn, kw, kh;
-        kn = key->units;
-        kw = kn * kbd_get_px_per_unit(kbd);
-        kh = kbd->layout.px_per_base;
+    cairo_destroy(cr);
+}
 
-        if (key->label) {
-            cairoext_rectangle_curved(cr, cx, cy, kw, kh, kbd_get_curve(kbd));
+static void kbd_band_render_task(void *data, size_t i) {
+    kbd_t *kbd = data;
+    kbd_band_render(kbd, &kbd->bands[kbd->dirty[i]]);
+}
 
-            cairo_set_source_rgb(cr, RGB(0, 0, 0));
-            cairo_stroke_preserve(cr);
+// kbd_update renders the bands which changed since the last frame for the
+// specified size, and returns the number of milliseconds after which it needs
+// to be called again, or -1. If timing is true, the time taken is printed.
+static int kbd_update(kbd_t *kbd, int width, int height, bool timing) {
+    double scale = fmin((double)(width)/kbd_get_width(kbd), (double)(height)/kbd_get_height(kbd));
+    if (scale <= 0)
+        return -1;
+
+    // the motion since the last frame is taken all at once (clearing the flag
+    // first so motion added during this frame causes another redraw), and the
+    // last non-zero amount is shown until KBD_REL_HOLD_MS after it was received
+    int64_t now = kbd_clock_ms(), until = 0;
+    bool rel_dirty[2] = {false, false};
+    atomic_store(&kbd->rel_pending, false);
+    for (int i = 0; i < 2; i++) {
+        int v[2];
+        for (int j = 0; j < 2; j++)
+            v[j] = atomic_exchange_explicit(&kbd->rel[i][j], 0, memory_order_relaxed);
+        if (v[0] || v[1]) {
+            memcpy(kbd->drawn_rel[i], v, sizeof(v));
+            kbd->drawn_rel_until[i] = now + KBD_REL_HOLD_MS;
+            rel_dirty[i] = true;
+        } else if (kbd->drawn_rel_until[i] && now >= kbd->drawn_rel_until[i]) {
+            memset(kbd->drawn_rel[i], 0, sizeof(v));
+            kbd->drawn_rel_until[i] = 0;
+            rel_dirty[i] = true;
+        }
+        if (kbd->drawn_rel_until[i] && (!until || kbd->drawn_rel_until[i] < until))
+            until = kbd->drawn_rel_until[i];
+    }
 
-            switch (kbd_get_state(kbd, key->code)) {
-            case 0: cairo_set_source_rgb(cr, RGB(255, 255, 255)); break; // UP
-            case 1: cairo_set_source_rgb(cr, RGB(214, 194, 194)); break; // DOWN
-            case 2: cairo_set_source_rgb(cr, RGB(194, 163, 163)); break; // HOLD
-            default: assert(0);
+    // the heatmap is relative to the most used key in the layout, and
+    // logarithmic, since a few keys (e.g. space) are usually pressed far more
+    // than the rest
+    double range = 0;
+    if (kbd->heatmap) {
+        uint64_t max = 0;
+        for (size_t i = 0; i < kbd->layout.n_keys; i++) {
+            kbd_layout_key_t *key = &kbd->layout.keys[i];
+            if (key->label && key->code < KEY_CNT) {
+                uint64_t v = kbd_get_heat(kbd, key->code);
+                if (v > max)
+                    max = v;
             }
-            cairo_fill(cr);
-
-            cairo_text_extents_t et;
-            cairo_text_extents(cr, key->label, &et);
-            cairo_move_to(cr,
-                cx + 0.5 + kw/2 - et.x_bearing - et.width/2,
-                cy + 0.5 + kh/2 + kbd_get_padding(kbd) - ef.descent + et.height/2
-            );
-            cairo_set_source_rgb(cr, RGB(0, 0, 0));
-            cairo_show_text(cr, key->label);
         }
+        range = ceil(log1p(max) / KBD_HEAT_RANGE_STEP) * KBD_HEAT_RANGE_STEP;
+    }
 
-        assert(cn+kn <= kbd->layout.units_per_row);
-        if (cn+kn == kbd->layout.units_per_row) {
-            cx = kbd_get_gap(kbd);
-            cy += kbd->layout.px_per_base + kbd_get_gap(kbd);
-            cn = 0;
-        } else {
-            cx += kw;
-            cn += kn;
+    // the states are read once here, so the bands are rendered consistently
+    size_t n_dirty = 0;
+    for (size_t i = 0; i < kbd->n_bands; i++) {
+        kbd_band_t *b = &kbd->bands[i];
+        bool dirty = false;
+        for (size_t j = b->key0; j < b->key1; j++) {
+            kbd_layout_key_t *key = &kbd->layout.keys[j];
+            if (!key->label)
+                continue;
+            if (key->code >= KEY_CNT) {
+                if (rel_dirty[key->code - KEY_CNT])
+                    dirty = true;
+                continue;
+            }
+            int state = kbd_get_state(kbd, key->code);
+            assert(state >= 0 && state < 3);
+            if (state != kbd->drawn_state[j]) {
+                kbd->drawn_state[j] = state;
+                dirty = true;
+            }
+            if (kbd->heatmap) {
+                // only changes to the shade matter, not every press
+                uint64_t v = kbd_get_heat(kbd, key->code);
+                // (it may have been used since range was found)
+                int heat = v ? (int)(ceil(KBD_HEAT_LEVELS * log1p(v) / fmax(range, log1p(v)))) : 0;
+                if (heat != kbd->drawn_heat[j]) {
+                    kbd->drawn_heat[j] = heat;
+                    dirty = true;
+                }
+            }
         }
-        assert(cx <= tw);
-        assert(cy <= th);
+        if (dirty)
+            kbd->dirty[n_dirty++] = i;
+    }
+
+    // everything needs to be redrawn if the scale changes
+    if (scale != kbd->scale)
+        for (n_dirty = 0; n_dirty < kbd->n_bands; n_dirty++)
+            kbd->dirty[n_dirty] = n_dirty;
+    kbd->scale = scale;
+
+    struct timespec t0, t1;
+    if (timing)
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    // the workers are only woken if more than one band needs rendering (e.g.
+    // after a resize), since a single keypress only affects one row
+    if (kbd->pool)
+        pool_run(kbd->pool, kbd_band_render_task, kbd, n_dirty);
+    else
+        for (size_t i = 0; i < n_dirty; i++)
+            kbd_band_render_task(kbd, i);
+
+    if (timing && n_dirty) {
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        printf("Timing: rendered %zu of %zu rows in %.2fms.\n", n_dirty, kbd->n_bands,
+            (t1.tv_sec - t0.tv_sec)*1000.0 + (t1.tv_nsec - t0.tv_nsec)/1000000.0);
+    }
+
+    return until ? (int)(until - now) : -1;
+}
+
+void kbd_prepare(kbd_t *kbd, int width, int height) {
+    // only the frames which are shown are timed, since the layouts being
+    // prepared in the background aren't identified in the output
+    kbd_update(kbd, width, height, false);
+}
+
+int kbd_draw(kbd_t *kbd, cairo_t *cr, int width, int height) {
+    #define RGB(r, g, b) (double)(r)/255.0l, (double)(g)/255.0l, (double)(b)/255.0l
+
+    int tw, th;
+    tw = kbd_get_width(kbd);
+    th = kbd_get_height(kbd);
+
+    double scale = fmin((double)(width)/tw, (double)(height)/th);
+    if (scale <= 0)
+        return -1;
+
+    int ms = kbd_update(kbd, width, height, kbd->timing);
+
+    // whole pixels, so the rasterized bands are copied without resampling
+    int ox, oy;
+    ox = (width - (int)(round(tw*scale)))/2;
+    oy = (height - (int)(round(th*scale)))/2;
+
+    cairo_set_source_rgb(cr, RGB(244, 239, 239));
+    cairo_paint(cr);
+
+    for (size_t i = 0; i < kbd->n_bands; i++) {
+        kbd_band_t *b = &kbd->bands[i];
+        cairo_rectangle(cr, ox, oy + b->dy, round(tw*scale), b->h);
+        cairo_set_source_surface(cr, b->frame, ox, oy + b->dy);
+        cairo_fill(cr);
     }
 
+    return ms;
+
     #undef RGB
 }
 
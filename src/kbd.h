@@ -1,16 +1,30 @@
 #ifndef KBDSCR_KBD_H
 #define KBDSCR_KBD_H
+#include <stdbool.h>
 #include <stddef.h>
 #include <cairo/cairo.h>
 #include <linux/input-event-codes.h>
+#include "kbd_usage.h"
+#include "pool.h"
 
 // kbd_layout_key_t represents a key on a keyboard layout.
 typedef struct {
     int  units;    // the number of units wide the key/spacer is
     char *label;   // the key label to use (if NULL, this key is treated as a spacer)
-    int  code; // KEY_* and BTN_* from linux/input-event-codes.h
+    int  code; // KEY_* and BTN_* from linux/input-event-codes.h, or KBD_KEY_REL_*
 } kbd_layout_key_t;
 
+// KBD_KEY_REL_MOTION and KBD_KEY_REL_WHEEL can be used as the code of a key to
+// show the direction of the pointer motion or the scroll wheel on it instead of
+// a key state.
+#define KBD_KEY_REL_MOTION (KEY_CNT + 0)
+#define KBD_KEY_REL_WHEEL  (KEY_CNT + 1)
+
+// KBD_HEATMAP_* are what kbd_set_usage can color the keys by.
+#define KBD_HEATMAP_NONE    0
+#define KBD_HEATMAP_PRESSES 1 // the number of times each key was pressed
+#define KBD_HEATMAP_HELD    2 // the total time each key was held down for
+
 // kbd_layout_t represents a keyboard layout. The total number of units must be
 // divisible by the number of units per row without splitting keys for the
 // rendering to work correctly. Keys spanning multiple rows or with different
@@ -45,20 +59,58 @@ void kbd_free(kbd_t *kbd);
 // disable it.
 void kbd_set_redraw_cb(kbd_t *kbd, void (*fn)(void*), void* data);
 
+// kbd_set_pool sets the worker pool to render the rows of the keyboard on in
+// parallel (or NULL to render them on the calling thread). The pool may be
+// shared by multiple kbd_t as long as they aren't drawn concurrently.
+void kbd_set_pool(kbd_t *kbd, pool_t *pool);
+
+// kbd_set_usage sets the usage counters to update on each key state change (or
+// NULL to disable them), and what to color the keys by (KBD_HEATMAP_*). It
+// should be called before kbd_set_state is first called, and the kbd_usage_t
+// must not be closed until the kbd_t is freed.
+void kbd_set_usage(kbd_t *kbd, kbd_usage_t *usage, int heatmap);
+
+// kbd_set_timing sets whether to print the time taken to render the rows which
+// changed for each frame drawn with kbd_draw (but not kbd_prepare).
+void kbd_set_timing(kbd_t *kbd, bool timing);
+
 // kbd_set_state sets the state of a KEY_* or BTN_* to UP (0), DOWN (1), or
 // HOLD (2). It safe to call concurrently and/or from multiple threads.
 void kbd_set_state(kbd_t *kbd, int key, int state);
 
+// kbd_add_rel adds relative pointer motion and scroll wheel detents (in the
+// direction of REL_X, REL_Y, REL_WHEEL, and REL_HWHEEL) to be shown on the next
+// frame. The redraw callback is called at most once per frame no matter how
+// many times this is called. It safe to call concurrently and/or from multiple
+// threads.
+void kbd_add_rel(kbd_t *kbd, int dx, int dy, int wheel, int hwheel);
+
+// kbd_has_key checks whether the layout contains a KEY_*, BTN_*, or KBD_KEY_REL_*.
+bool kbd_has_key(kbd_t *kbd, int key);
+
 // kbd_get_rows gets the number of rows of keys in the kbd_t.
 int kbd_get_rows(kbd_t *kbd);
 
-// kbd_get_width gets the expected width of the rendered keyboard in pixels.
+// kbd_get_width gets the width of the rendered keyboard in pixels at a scale of
+// 1.
 int kbd_get_width(kbd_t *kbd);
 
-// kbd_get_height gets the expected height of the rendered keyboard in pixels.
+// kbd_get_height gets the height of the rendered keyboard in pixels at a scale
+// of 1.
 int kbd_get_height(kbd_t *kbd);
 
-// kbd_draw renders the keyboard on to the provided Cairo context.
-void kbd_draw(kbd_t *kbd, cairo_t *cr);
+// kbd_prepare renders the keyboard for an area of the specified size like
+// kbd_draw, but without drawing it anywhere, so a later kbd_draw with the same
+// size only needs to copy the rows which were already rendered. It must not be
+// called concurrently with itself or kbd_draw.
+void kbd_prepare(kbd_t *kbd, int width, int height);
+
+// kbd_draw renders the keyboard on to the provided Cairo context, scaled to fit
+// and centered in an area of the specified size. Each row is rendered into a
+// separate surface, which is only redone when a key in it changes, and the keys
+// are rasterized ahead of time, which is only redone when the scale changes. It
+// must not be called concurrently. It returns the number of milliseconds after
+// which it needs to be called again (to clear the motion indicators), or -1.
+int kbd_draw(kbd_t *kbd, cairo_t *cr, int width, int height);
 
 #endif
\ No newline at end of file
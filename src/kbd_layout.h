@@ -16,10 +16,11 @@
 
 // KBD_LAYOUTS calls a macro X(layout, id, desc) for each built-in layout.
 #define KBD_LAYOUTS \
-    X(KBD_LAYOUT_US_MOUSE,   "km-us-en",    "US English Keyboard, plus three standard mouse buttons") \
+    X(KBD_LAYOUT_US_MOUSE,   "km-us-en",    "US English Keyboard, plus three standard mouse buttons, motion, and wheel") \
     X(KBD_LAYOUT_MOUSE_M570, "m-logi-m570", "Logitech M570 mouse")
 
-// KBD_LAYOUT_US_MOUSE is a US English keyboard, plus three mouse buttons.
+// KBD_LAYOUT_US_MOUSE is a US English keyboard, plus three mouse buttons and the
+// pointer motion and scroll wheel.
 #define KBD_LAYOUT_US_MOUSE KBD_LAYOUT( \
     74, 4, 24, \
     {4, "Esc", KEY_ESC}, {6}, {4, "F1", KEY_F1}, {1}, {4, "F2", KEY_F2}, {1}, {4, "F3", KEY_F3}, {1}, {4, "F4", KEY_F4}, {4}, {4, "F5", KEY_F5}, {1}, {4, "F6", KEY_F6}, {1}, {4, "F7", KEY_F7}, {1}, {4, "F8", KEY_F8}, {3}, {4, "F9", KEY_F9}, {1}, {4, "F10", KEY_F10}, {1}, {4, "F11", KEY_F11}, {1}, {4, "F12", KEY_F12}, \
@@ -28,13 +29,14 @@
     {9, "Caps", KEY_CAPSLOCK}, {1}, {4, "A", KEY_A}, {1}, {4, "S", KEY_S}, {1}, {4, "D", KEY_D}, {1}, {4, "F", KEY_F}, {1}, {4, "G", KEY_G}, {1}, {4, "H", KEY_H}, {1}, {4, "J", KEY_J}, {1}, {4, "K", KEY_K}, {1}, {4, "L", KEY_L}, {1}, {4, ";", KEY_SEMICOLON}, {1}, {4, "'", KEY_APOSTROPHE}, {1}, {9, "Enter", KEY_ENTER}, \
     {12, "Shift", KEY_LEFTSHIFT}, {1}, {4, "Z", KEY_Z}, {1}, {4, "X", KEY_X}, {1}, {4, "C", KEY_C}, {1}, {4, "V", KEY_V}, {1}, {4, "B", KEY_B}, {1}, {4, "N", KEY_N}, {1}, {4, "M", KEY_M}, {1}, {4, ",", KEY_COMMA}, {1}, {4, ".", KEY_DOT}, {1}, {4, "/", KEY_SLASH}, {1}, {11, "Shift", KEY_RIGHTSHIFT}, \
     {5, "Ctrl", KEY_LEFTCTRL}, {1}, {5, "Sup", KEY_LEFTMETA}, {1}, {5, "Alt", KEY_LEFTALT}, {1}, {32, "Space", KEY_SPACE}, {1}, {5, "Alt", KEY_RIGHTALT}, {1}, {5, "Sup", KEY_RIGHTMETA}, {1}, {5, "Fn", KEY_FN}, {1}, {5, "Ctrl", KEY_RIGHTCTRL}, \
-    {12}, {16, "Mouse Left", BTN_LEFT}, {1}, {16, "Mouse Middle", BTN_MIDDLE}, {1}, {16, "Mouse Right", BTN_RIGHT}, {12}, \
+    {11, "Move", KBD_KEY_REL_MOTION}, {1}, {16, "Mouse Left", BTN_LEFT}, {1}, {16, "Mouse Middle", BTN_MIDDLE}, {1}, {16, "Mouse Right", BTN_RIGHT}, {1}, {11, "Wheel", KBD_KEY_REL_WHEEL}, \
 )
 
 // KBD_LAYOUT_US_MOUSE is a Logitech M570 trackball.
 #define KBD_LAYOUT_MOUSE_M570 KBD_LAYOUT( \
     48, 4, 24, \
     {4, "<", BTN_SIDE}, {1}, {12, "Left", BTN_LEFT}, {1}, {12, "Middle", BTN_MIDDLE}, {1}, {12, "Right", BTN_RIGHT}, {1}, {4, ">", BTN_EXTRA}, \
+    {5}, {25, "Move", KBD_KEY_REL_MOTION}, {1}, {12, "Wheel", KBD_KEY_REL_WHEEL}, {5}, \
 )
 
 #endif
\ No newline at end of file
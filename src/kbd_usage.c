@@ -0,0 +1,134 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/input-event-codes.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "kbd_usage.h"
+
+#define KBD_USAGE_MAGIC "KBDSCRU1"
+
+// kbd_usage_file_t is the layout of the usage file. It is native-endian and
+// only meant to be used on the machine it was created on.
+typedef struct {
+    char     magic[8];
+    uint32_t n_keys; // KEY_CNT when the file was created
+    uint32_t reserved;
+    struct {
+        _Atomic uint64_t presses;
+        _Atomic uint64_t held_ms;
+    } keys[KEY_CNT];
+} kbd_usage_file_t;
+
+struct kbd_usage_t {
+    int              fd;
+    kbd_usage_file_t *f;
+    _Atomic uint64_t down_at[KEY_CNT]; // when each key was last pressed, in milliseconds
+};
+
+kbd_usage_t *kbd_usage_open(const char *path, char **err) {
+    #define kbd_usage_open_err(format, ...) do {      \
+        if (err)                                      \
+            asprintf(err, format, ##__VA_ARGS__);     \
+        if (u->fd != -1)                              \
+            close(u->fd);                             \
+        free(u);                                      \
+        return NULL;                                  \
+    } while (0)
+
+    kbd_usage_t *u = calloc(1, sizeof(kbd_usage_t));
+
+    struct stat st;
+    if ((u->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) == -1)
+        kbd_usage_open_err("open '%s': %s", path, strerror(errno));
+    if (fstat(u->fd, &st))
+        kbd_usage_open_err("stat '%s': %s", path, strerror(errno));
+
+    // the header is written before the file is extended, so a crash while
+    // creating it can only leave a header-only file, which is extended here if
+    // the header is valid
+    kbd_usage_file_t hdr = {0};
+    size_t n = offsetof(kbd_usage_file_t, keys);
+    if (st.st_size == 0) {
+        memcpy(hdr.magic, KBD_USAGE_MAGIC, sizeof(hdr.magic));
+        hdr.n_keys = KEY_CNT;
+        if (pwrite(u->fd, &hdr, n, 0) != (ssize_t)(n))
+            kbd_usage_open_err("write header to '%s': %s", path, strerror(errno));
+        st.st_size = n;
+    } else if (st.st_size == (off_t)(n)) {
+        if (pread(u->fd, &hdr, n, 0) != (ssize_t)(n))
+            kbd_usage_open_err("read header from '%s': %s", path, strerror(errno));
+        if (memcmp(hdr.magic, KBD_USAGE_MAGIC, sizeof(hdr.magic)) || hdr.n_keys != KEY_CNT)
+            kbd_usage_open_err("'%s' is not a usage file for this version of kbdscr (bad header)", path);
+    }
+    if (st.st_size == (off_t)(n)) {
+        if (ftruncate(u->fd, sizeof(kbd_usage_file_t)))
+            kbd_usage_open_err("resize '%s': %s", path, strerror(errno));
+    } else if (st.st_size != sizeof(kbd_usage_file_t)) {
+        kbd_usage_open_err("'%s' is not a usage file for this version of kbdscr (wrong size: expected %zu, got %lld)", path, sizeof(kbd_usage_file_t), (long long)(st.st_size));
+    }
+
+    if ((u->f = mmap(NULL, sizeof(kbd_usage_file_t), PROT_READ | PROT_WRITE, MAP_SHARED, u->fd, 0)) == MAP_FAILED)
+        kbd_usage_open_err("map '%s': %s", path, strerror(errno));
+
+    if (memcmp(u->f->magic, KBD_USAGE_MAGIC, sizeof(u->f->magic)) || u->f->n_keys != KEY_CNT) {
+        munmap(u->f, sizeof(kbd_usage_file_t));
+        kbd_usage_open_err("'%s' is not a usage file for this version of kbdscr (bad header)", path);
+    }
+
+    if (err)
+        *err = NULL;
+    return u;
+
+    #undef kbd_usage_open_err
+}
+
+void kbd_usage_close(kbd_usage_t *u) {
+    munmap(u->f, sizeof(kbd_usage_file_t));
+    close(u->fd);
+    free(u);
+}
+
+static inline uint64_t kbd_usage_now_ms(void) {
+    // the coarse clock is read from the vDSO without a syscall, and its
+    // resolution (usually a few ms) is plenty for hold times
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)(ts.tv_sec)*1000 + ts.tv_nsec/1000000;
+}
+
+void kbd_usage_record(kbd_usage_t *u, int key, int old, int state) {
+    assert(key > 0 && key <= KEY_MAX);
+    // down_at is swapped rather than just set so each change is only counted
+    // once even if it is reported by multiple kbd_t sharing the kbd_usage_t
+    if (!old && state) {
+        uint64_t zero = 0;
+        if (atomic_compare_exchange_strong_explicit(&u->down_at[key], &zero, kbd_usage_now_ms(), memory_order_relaxed, memory_order_relaxed))
+            atomic_fetch_add_explicit(&u->f->keys[key].presses, 1, memory_order_relaxed);
+    } else if (old && !state) {
+        uint64_t down_at = atomic_exchange_explicit(&u->down_at[key], 0, memory_order_relaxed);
+        if (down_at)
+            atomic_fetch_add_explicit(&u->f->keys[key].held_ms, kbd_usage_now_ms() - down_at, memory_order_relaxed);
+    }
+}
+
+uint64_t kbd_usage_get_presses(kbd_usage_t *u, int key) {
+    assert(key > 0 && key <= KEY_MAX);
+    return atomic_load_explicit(&u->f->keys[key].presses, memory_order_relaxed);
+}
+
+uint64_t kbd_usage_get_held_ms(kbd_usage_t *u, int key) {
+    assert(key > 0 && key <= KEY_MAX);
+    return atomic_load_explicit(&u->f->keys[key].held_ms, memory_order_relaxed);
+}
@@ -0,0 +1,35 @@
+#ifndef KBDSCR_KBD_USAGE_H
+#define KBDSCR_KBD_USAGE_H
+#include <stdint.h>
+
+// kbd_usage_t tracks the number of presses and the total hold time of each
+// KEY_* and BTN_*. The counters live in a shared memory mapping of a file, so
+// they are persisted continuously by the kernel (and survive crashes) without
+// ever being serialized.
+typedef struct kbd_usage_t kbd_usage_t;
+
+// kbd_usage_open maps the specified usage file, creating it if it doesn't
+// exist. If any errors ocurred, the return value will be NULL, and if err is not
+// NULL, its target will be set to a string describing the error (which will
+// need to be freed by the caller). Otherwise, the return value will be an
+// allocated kbd_usage_t.
+kbd_usage_t *kbd_usage_open(const char *path, char **err);
+
+// kbd_usage_close unmaps the usage file and frees the kbd_usage_t.
+void kbd_usage_close(kbd_usage_t *u);
+
+// kbd_usage_record updates the counters for a state change of a KEY_* or BTN_*
+// from old to state (see kbd_set_state). It does not lock or allocate, and it is
+// safe to call concurrently and/or from multiple threads. If the same change is
+// recorded more than once (e.g. by multiple kbd_t with the same key), it is only
+// counted once.
+void kbd_usage_record(kbd_usage_t *u, int key, int old, int state);
+
+// kbd_usage_get_presses gets the number of times a KEY_* or BTN_* was pressed.
+uint64_t kbd_usage_get_presses(kbd_usage_t *u, int key);
+
+// kbd_usage_get_held_ms gets the total time in milliseconds a KEY_* or BTN_*
+// was held down for.
+uint64_t kbd_usage_get_held_ms(kbd_usage_t *u, int key);
+
+#endif
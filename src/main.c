@@ -1,88 +1,361 @@
+#include <math.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
+#include "ctl.h"
 #include "evdev.h"
 #include "kbd.h"
 #include "kbd_layout.h"
+#include "kbd_usage.h"
+#include "pool.h"
 #include "win.h"
 
 #ifndef KBDSCR_VERSION
 #define KBDSCR_VERSION "unknown"
 #endif
 
+// SCREEN_PREPARE_MS is the minimum time between preparing the layouts which
+// aren't shown after they change (see screen_prepare).
+#define SCREEN_PREPARE_MS 100
+
+// layouts contains the built-in layouts (at file scope so the keys have static
+// storage duration).
+static const struct {
+    kbd_layout_t layout;
+    const char   *id;
+    const char   *desc;
+} layouts[] = {
+    #define X(layout, id, desc) {layout, id, desc},
+        KBD_LAYOUTS
+    #undef X
+};
+
+// screen_t is a window which shows one of several layouts at a time. All of
+// them receive the key events, so they're up to date when switched to.
+typedef struct {
+    x11win_t      *win;
+    size_t        n_kbd;
+    const char    *ids[EVDEV_WATCH_KEY_MAX_SINKS];
+    kbd_t         *kbds[EVDEV_WATCH_KEY_MAX_SINKS];
+    atomic_size_t want;           // the layout to show (set from any thread)
+    size_t        active;         // the layout shown by the last frame
+    double        scale;          // the scale of the last frame
+    atomic_bool   stale;          // whether the other layouts changed since being prepared (set from any thread)
+    double        prepared_scale; // the scale the other layouts were last prepared at
+    int64_t       prepared_at;    // when the other layouts were last prepared
+} screen_t;
+
+// screen_kbd_t identifies a layout of a screen for kbd_set_redraw_cb.
+typedef struct {
+    screen_t *s;
+    size_t   i;
+} screen_kbd_t;
+
+// screens_t is the list of screens for the control socket.
+typedef struct {
+    size_t   n_screen;
+    screen_t *screens;
+} screens_t;
+
+static void screen_switch(screen_t *s, size_t i) {
+    atomic_store(&s->want, i);
+    x11win_redraw(s->win);
+}
+
+static int64_t clock_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)(ts.tv_sec)*1000 + ts.tv_nsec/1000000;
+}
+
+static void screen_redraw(screen_kbd_t *k) {
+    // the other layouts are updated by screen_prepare after a frame
+    if (atomic_load(&k->s->want) == k->i)
+        x11win_redraw(k->s->win);
+    else
+        atomic_store(&k->s->stale, true);
+}
+
+static int screen_draw(screen_t *s, cairo_t *cr, int width, int height) {
+    kbd_t *kbd = s->kbds[s->active];
+    s->scale = fmin((double)(width)/kbd_get_width(kbd), (double)(height)/kbd_get_height(kbd));
+
+    size_t want = atomic_load(&s->want);
+    if (want == s->active)
+        return kbd_draw(kbd, cr, width, height);
+
+    // resize the window to fit the new layout at the same scale, which makes
+    // this get called again at that size (which screen_prepare already
+    // rendered it at) right away rather than waiting for the window to be
+    // resized
+    s->active = want;
+    kbd = s->kbds[want];
+    x11win_set_size(s->win, kbd_get_width(kbd), kbd_get_height(kbd), s->scale);
+    return 0;
+}
+
+static void screen_prepare(screen_t *s) {
+    // render the other layouts at the size they would be shown at, so
+    // switching to them only needs to copy the rows, but only as often as
+    // needed to keep that true (anything which changed since then is rendered
+    // by the first frame after switching), since it's as much work as drawing
+    // them and usually happens on every frame (e.g., for mouse movement)
+    int64_t now = clock_ms();
+    if (s->scale == s->prepared_scale) {
+        if (now < s->prepared_at + SCREEN_PREPARE_MS || !atomic_exchange(&s->stale, false))
+            return;
+    } else {
+        atomic_store(&s->stale, false);
+    }
+    s->prepared_scale = s->scale;
+    s->prepared_at = now;
+
+    for (size_t i = 0; i < s->n_kbd; i++) {
+        kbd_t *kbd = s->kbds[i];
+        if (i != s->active)
+            kbd_prepare(kbd, round(kbd_get_width(kbd)*s->scale), round(kbd_get_height(kbd)*s->scale));
+    }
+}
+
+static void screen_key(screen_t *s, int code) {
+    if (code == KEY_TAB)
+        screen_switch(s, (atomic_load(&s->want) + 1) % s->n_kbd);
+    else if (code >= KEY_1 && code <= KEY_9 && (size_t)(code - KEY_1) < s->n_kbd)
+        screen_switch(s, code - KEY_1);
+}
+
+static const char *handle_command(screens_t *ss, const char *cmd) {
+    if (!strcmp(cmd, "next")) {
+        for (size_t i = 0; i < ss->n_screen; i++) {
+            screen_t *s = &ss->screens[i];
+            if (s->n_kbd > 1)
+                screen_switch(s, (atomic_load(&s->want) + 1) % s->n_kbd);
+        }
+        return NULL;
+    }
+    if (!strncmp(cmd, "layout ", 7)) {
+        bool found = false;
+        for (size_t i = 0; i < ss->n_screen; i++) {
+            screen_t *s = &ss->screens[i];
+            for (size_t j = 0; j < s->n_kbd; j++) {
+                if (!strcmp(cmd + 7, s->ids[j])) {
+                    screen_switch(s, j);
+                    found = true;
+                }
+            }
+        }
+        return found ? NULL : "no window has that layout";
+    }
+    return "unknown command";
+}
+
 void handle_error(void* data __attribute__((unused)), const char *msg) {
     printf("Warning: %s\n", msg);
 }
 
 int main(int argc, char **argv) {
     if (argc < 3 || !strcmp(argv[1], "-h") || !strcmp(argv[1], "--help")) {
-        fprintf(stderr, "Usage: %s layout input_event_evdev_path...\n", argv[0]);
+        fprintf(stderr, "Usage: %s layout[/layout...][,layout[/layout...]...] input_event_evdev_path...\n", argv[0]);
         fprintf(stderr, "Version: kbdscr %s\n", KBDSCR_VERSION);
         fprintf(stderr, "Layouts:\n");
-        #define X(_, id, desc) \
-            fprintf(stderr, "    %-16s %s\n", id, desc);
-            KBD_LAYOUTS
-        #undef X
+        for (size_t i = 0; i < sizeof(layouts)/sizeof(*layouts); i++)
+            fprintf(stderr, "    %-16s %s\n", layouts[i].id, layouts[i].desc);
         fprintf(stderr, "Example: sudo %s km-us-en /dev/input/event*\n", argv[0]);
+        fprintf(stderr, "Example: sudo %s km-us-en,m-logi-m570 /dev/input/event*\n", argv[0]);
+        fprintf(stderr, "Example: sudo %s km-us-en/m-logi-m570 /dev/input/event*\n", argv[0]);
         return EXIT_SUCCESS;
     }
 
-    bool found = false;
-    kbd_layout_t layout;
-    #define X(layout_, id, desc) \
-        if (!strcmp(argv[1], id)) { \
-            layout = layout_; \
-            found = true; \
+    int ret = EXIT_FAILURE;
+    char *err;
+
+    // each window can have multiple layouts to switch between, but every
+    // layout needs a sink, so the limit is on the total
+    size_t n_kbd = 0;
+    size_t n_screen = 0;
+    screen_t *screens = calloc(EVDEV_WATCH_KEY_MAX_SINKS, sizeof(screen_t));
+    screen_kbd_t sks[EVDEV_WATCH_KEY_MAX_SINKS];
+    evdev_watch_key_sink_t sinks[EVDEV_WATCH_KEY_MAX_SINKS];
+
+    kbd_usage_t *u = NULL;
+    pool_t *p = NULL;
+    x11win_conn_t *c = NULL;
+    evdev_watch_key_t *w = NULL;
+    ctl_t *ctl = NULL;
+    screens_t ss = {0, screens};
+
+    char *save_screen, *save_kbd;
+    for (char *grp = strtok_r(argv[1], ",", &save_screen); grp; grp = strtok_r(NULL, ",", &save_screen)) {
+        // every screen has at least one layout, so this also limits the screens
+        if (n_kbd == EVDEV_WATCH_KEY_MAX_SINKS) {
+            printf("Error: initialize keyboard layout: too many layouts (max %d).\n", EVDEV_WATCH_KEY_MAX_SINKS);
+            goto cleanup;
         }
-        KBD_LAYOUTS
-    #undef X
-    if (!found) {
-        printf("Error: initialize keyboard layout: could not find layout %s.\n", argv[1]);
-        return EXIT_FAILURE;
+        screen_t *s = &screens[n_screen++];
+        for (char *id = strtok_r(grp, "/", &save_kbd); id; id = strtok_r(NULL, "/", &save_kbd)) {
+            if (n_kbd == EVDEV_WATCH_KEY_MAX_SINKS) {
+                printf("Error: initialize keyboard layout: too many layouts (max %d).\n", EVDEV_WATCH_KEY_MAX_SINKS);
+                goto cleanup;
+            }
+
+            const kbd_layout_t *layout = NULL;
+            for (size_t i = 0; i < sizeof(layouts)/sizeof(*layouts); i++)
+                if (!strcmp(id, layouts[i].id))
+                    layout = &layouts[i].layout;
+            if (!layout) {
+                printf("Error: initialize keyboard layout: could not find layout %s.\n", id);
+                goto cleanup;
+            }
+
+            s->ids[s->n_kbd] = id;
+            s->kbds[s->n_kbd] = kbd_new(*layout, &err);
+            if (err) {
+                printf("Error: initialize keyboard layout %s: %s.\n", id, err);
+                free(err);
+                goto cleanup;
+            }
+            sks[n_kbd++] = (screen_kbd_t){s, s->n_kbd++};
+        }
+        if (!s->n_kbd)
+            n_screen--;
+    }
+    if (!n_kbd) {
+        printf("Error: initialize keyboard layout: no layouts specified.\n");
+        goto cleanup;
     }
 
-    char *err;
+    const char *usage = getenv("KBDSCR_USAGE");
+    if (usage && *usage) {
+        u = kbd_usage_open(usage, &err);
+        if (err) {
+            printf("Error: open usage file: %s.\n", err);
+            free(err);
+            goto cleanup;
+        }
+        const char *heatmap = getenv("KBDSCR_HEATMAP");
+        int mode = KBD_HEATMAP_NONE;
+        if (heatmap && *heatmap)
+            mode = strcmp(heatmap, "held") ? KBD_HEATMAP_PRESSES : KBD_HEATMAP_HELD;
+        for (size_t i = 0; i < n_kbd; i++)
+            kbd_set_usage(sks[i].s->kbds[sks[i].i], u, mode);
+    }
 
-    kbd_t *kbd = kbd_new(layout, &err);
-    if (err) {
-        printf("Error: initialize keyboard layout: %s.\n", err);
-        free(err);
-        return EXIT_FAILURE;
+    const char *timing = getenv("KBDSCR_TIMING");
+    for (size_t i = 0; i < n_kbd; i++)
+        kbd_set_timing(sks[i].s->kbds[sks[i].i], timing && *timing);
+
+    // the built-in layouts are small enough that the workers would mostly just
+    // add wakeups, so they're only used if asked for
+    long n_threads = 0;
+    const char *threads = getenv("KBDSCR_THREADS");
+    if (threads && *threads) {
+        char *end;
+        n_threads = strtol(threads, &end, 10);
+        if (*end || n_threads < 0) {
+            printf("Error: start render workers: invalid KBDSCR_THREADS '%s'.\n", threads);
+            goto cleanup;
+        }
+    }
+    if (n_threads > 0) {
+        p = pool_new(n_threads, &err);
+        if (err) {
+            printf("Error: start render workers: %s.\n", err);
+            free(err);
+            goto cleanup;
+        }
+        for (size_t i = 0; i < n_kbd; i++)
+            kbd_set_pool(sks[i].s->kbds[sks[i].i], p);
     }
 
-    x11win_t *x = x11win_new("kbdscr", "net.pgaskin.kbdscr", kbd_get_width(kbd), kbd_get_height(kbd), &err);
+    c = x11win_conn_new(&err);
     if (err) {
-        printf("Error: create window: %s.\n", err);
+        printf("Error: connect to display: %s.\n", err);
         free(err);
-        kbd_free(kbd);
-        return EXIT_FAILURE;
+        goto cleanup;
+    }
+
+    for (size_t i = 0; i < n_screen; i++) {
+        screen_t *s = &screens[i];
+
+        char title[64] = "kbdscr";
+        for (size_t j = 0; j < s->n_kbd && n_screen > 1; j++)
+            snprintf(title + strlen(title), sizeof(title) - strlen(title), "%s%s", j ? "/" : " - ", s->ids[j]);
+
+        s->win = x11win_new(c, title, "net.pgaskin.kbdscr", kbd_get_width(s->kbds[0]), kbd_get_height(s->kbds[0]), (int(*)(void*, cairo_t*, int, int))(screen_draw), s, &err);
+        if (err) {
+            printf("Error: create window: %s.\n", err);
+            free(err);
+            goto cleanup;
+        }
+        if (s->n_kbd > 1) {
+            x11win_set_key_cb(s->win, (void(*)(void*, int))(screen_key), s);
+            x11win_set_idle_cb(s->win, (void(*)(void*))(screen_prepare), s);
+        }
+    }
+
+    for (size_t i = 0; i < n_kbd; i++) {
+        kbd_t *kbd = sks[i].s->kbds[sks[i].i];
+        kbd_set_redraw_cb(kbd, (void(*)(void*))(screen_redraw), &sks[i]);
+
+        sinks[i] = (evdev_watch_key_sink_t){
+            .keystate_cb = (void(*)(void*, int, int))(kbd_set_state),
+            .has_key_cb  = (bool(*)(void*, int))(kbd_has_key),
+            .rel_cb      = kbd_has_key(kbd, KBD_KEY_REL_MOTION) || kbd_has_key(kbd, KBD_KEY_REL_WHEEL)
+                ? (void(*)(void*, int, int, int, int))(kbd_add_rel)
+                : NULL,
+            .data        = kbd,
+        };
     }
-    kbd_set_redraw_cb(kbd, (void(*)(void*))(x11win_redraw), x);
 
-    evdev_watch_key_t *w = evdev_watch_key_start((void(*)(void*, int, int))(kbd_set_state), handle_error, kbd, (const char**)(&argv[2]), argc-2, &err);
+    w = evdev_watch_key_start(sinks, n_kbd, handle_error, NULL, (const char**)(&argv[2]), argc-2, &err);
     if (err) {
         printf("Error: start evdev watcher: %s.\n", err);
         free(err);
-        x11win_free(x);
-        kbd_free(kbd);
-        return EXIT_FAILURE;
+        goto cleanup;
+    }
+
+    ss.n_screen = n_screen;
+    const char *control = getenv("KBDSCR_CONTROL");
+    if (control && *control) {
+        ctl = ctl_start(control, (const char *(*)(void*, const char*))(handle_command), handle_error, &ss, &err);
+        if (err) {
+            printf("Error: start control socket: %s.\n", err);
+            free(err);
+            goto cleanup;
+        }
     }
 
-    x11win_main(x, (void(*)(void*, cairo_t*))(kbd_draw), kbd, &err);
+    x11win_conn_main(c, &err);
     if (err) {
         printf("Error: run window main loop: %s.\n", err);
         free(err);
-        evdev_watch_key_stop(w);
-        x11win_free(x);
-        kbd_free(kbd);
-        return EXIT_FAILURE;
+        goto cleanup;
     }
 
     printf("Cleaning up.\n");
-    evdev_watch_key_stop(w);
-    x11win_free(x);
-    kbd_free(kbd);
-    return EXIT_SUCCESS;
+    ret = EXIT_SUCCESS;
+
+cleanup:
+    if (ctl)
+        ctl_stop(ctl);
+    if (w)
+        evdev_watch_key_stop(w);
+    for (size_t i = 0; i < n_screen; i++)
+        if (screens[i].win)
+            x11win_free(screens[i].win);
+    if (c)
+        x11win_conn_free(c);
+    if (p)
+        pool_free(p);
+    for (size_t i = 0; i < n_screen; i++)
+        for (size_t j = 0; j < screens[i].n_kbd; j++)
+            kbd_free(screens[i].kbds[j]);
+    free(screens);
+    if (u)
+        kbd_usage_close(u);
+    return ret;
 }
@@ -0,0 +1,122 @@
+#define _GNU_SOURCE
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "pool.h"
+
+struct pool_t {
+    size_t          n_threads;
+    pthread_t       *threads;
+    pthread_mutex_t mu;
+    pthread_cond_t  start;  // signaled once for each wake, or broadcast when stop is set
+    pthread_cond_t  done;   // signaled when active reaches 0
+    size_t          wake;   // the number of workers which still need to join the current batch
+    bool            stop;
+    size_t          active; // the number of workers woken for the current batch which haven't finished it
+    void            (*fn)(void *data, size_t i);
+    void            *data;
+    size_t          n;
+    atomic_size_t   next;   // the next task in the current batch
+};
+
+static void *pool_thread(pool_t *p);
+
+pool_t *pool_new(size_t n_threads, char **err) {
+    pool_t *p = calloc(1, sizeof(pool_t));
+    p->threads = calloc(n_threads, sizeof(pthread_t));
+    pthread_mutex_init(&p->mu, NULL);
+    pthread_cond_init(&p->start, NULL);
+    pthread_cond_init(&p->done, NULL);
+
+    for (; p->n_threads < n_threads; p->n_threads++) {
+        if (pthread_create(&p->threads[p->n_threads], NULL, (void*(*)(void*))(pool_thread), p) != 0) {
+            if (err)
+                asprintf(err, "could not start worker thread %zu", p->n_threads);
+            pool_free(p);
+            return NULL;
+        }
+    }
+
+    if (err)
+        *err = NULL;
+    return p;
+}
+
+void pool_free(pool_t *p) {
+    pthread_mutex_lock(&p->mu);
+    p->stop = true;
+    pthread_cond_broadcast(&p->start);
+    pthread_mutex_unlock(&p->mu);
+    for (size_t i = 0; i < p->n_threads; i++)
+        pthread_join(p->threads[i], NULL);
+    pthread_cond_destroy(&p->done);
+    pthread_cond_destroy(&p->start);
+    pthread_mutex_destroy(&p->mu);
+    free(p->threads);
+    free(p);
+}
+
+static void pool_work(void (*fn)(void *data, size_t i), void *data, size_t n, atomic_size_t *next) {
+    for (size_t i; (i = atomic_fetch_add_explicit(next, 1, memory_order_relaxed)) < n;)
+        fn(data, i);
+}
+
+void pool_run(pool_t *p, void (*fn)(void *data, size_t i), void *data, size_t n) {
+    if (n <= 1 || !p->n_threads) {
+        for (size_t i = 0; i < n; i++)
+            fn(data, i);
+        return;
+    }
+
+    // the calling thread takes a task too, so there's no point waking more
+    // workers than there are other tasks (e.g., only one for two rows)
+    size_t wake = n - 1 < p->n_threads ? n - 1 : p->n_threads;
+
+    pthread_mutex_lock(&p->mu);
+    p->fn = fn;
+    p->data = data;
+    p->n = n;
+    atomic_store_explicit(&p->next, 0, memory_order_relaxed);
+    p->active = p->wake = wake;
+    for (size_t i = 0; i < wake; i++)
+        pthread_cond_signal(&p->start);
+    pthread_mutex_unlock(&p->mu);
+
+    pool_work(fn, data, n, &p->next);
+
+    pthread_mutex_lock(&p->mu);
+    while (p->active)
+        pthread_cond_wait(&p->done, &p->mu);
+    pthread_mutex_unlock(&p->mu);
+}
+
+static void *pool_thread(pool_t *p) {
+    pthread_mutex_lock(&p->mu);
+    for (;;) {
+        // a worker which finishes quickly may take another wake for the same
+        // batch before the others wake up, but it'll just find nothing left
+        while (!p->wake && !p->stop)
+            pthread_cond_wait(&p->start, &p->mu);
+        if (p->stop)
+            break;
+        p->wake--;
+
+        void (*fn)(void *data, size_t i) = p->fn;
+        void *data = p->data;
+        size_t n = p->n;
+
+        pthread_mutex_unlock(&p->mu);
+        pool_work(fn, data, n, &p->next);
+        pthread_mutex_lock(&p->mu);
+
+        if (--p->active == 0)
+            pthread_cond_signal(&p->done);
+    }
+    pthread_mutex_unlock(&p->mu);
+    return NULL;
+}
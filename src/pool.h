@@ -0,0 +1,26 @@
+#ifndef KBDSCR_POOL_H
+#define KBDSCR_POOL_H
+#include <stddef.h>
+
+// pool_t is a small fixed-size pool of worker threads for running batches of
+// independent tasks.
+typedef struct pool_t pool_t;
+
+// pool_new starts a pool with the specified number of worker threads (which may
+// be 0, in which case everything is run on the calling thread). If any errors
+// ocurred, the return value will be NULL, and if err is not NULL, its target
+// will be set to a string describing the error (which will need to be freed by
+// the caller). Otherwise, the return value will be an allocated pool_t.
+pool_t *pool_new(size_t n_threads, char **err);
+
+// pool_free stops the worker threads and frees the pool_t.
+void pool_free(pool_t *p);
+
+// pool_run calls fn for each i from 0 to n-1, split between the calling thread
+// and the workers, and returns once all of them have finished. Only as many
+// workers are woken as there are tasks other than the one the calling thread
+// takes (i.e., none if there is only one task). It must not be called
+// concurrently.
+void pool_run(pool_t *p, void (*fn)(void *data, size_t i), void *data, size_t n);
+
+#endif
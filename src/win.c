@@ -1,114 +1,159 @@
 #define _GNU_SOURCE
 #include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include <cairo/cairo.h>
 #include <cairo/cairo-xcb.h>
 #include <xcb/xcb.h>
+#include <xcb/render.h>
+#include <xcb/shm.h>
 
 #include "win.h"
 
-struct x11win_t {
+// X11WIN_RESIZE_DEBOUNCE_MS is how long the window size needs to stay the same
+// before the contents are redrawn at the new size.
+#define X11WIN_RESIZE_DEBOUNCE_MS 100
+
+// X11WIN_FRAME_MS is the minimum time between redraws of a window, so a flood of
+// x11win_redraw calls doesn't result in more frames than can be displayed.
+#define X11WIN_FRAME_MS 8
+
+struct x11win_conn_t {
     xcb_connection_t *conn;
     xcb_screen_t *scr;
+    xcb_visualtype_t *vt;
+    xcb_intern_atom_cookie_t ck_wmdel, ck_wmprotocols; // sent and received by x11win_conn_main
+    xcb_atom_t wmdel, wmprotocols;
+    double scale;
+    size_t n_wins;
+    x11win_t **wins;
+    bool timing; // whether to print the startup timing after the first frame (KBDSCR_TIMING)
+    int64_t t_start, t_connect, t_surfaces, t_windows; // t_surfaces is the total time spent in cairo_xcb_surface_create
+};
+
+struct x11win_t {
+    x11win_conn_t *c;
     xcb_window_t win;
-    xcb_atom_t wmdel;
     cairo_surface_t *s;
     cairo_t *cr;
-    int width, height; // read-only, not updated
+    cairo_surface_t *bufs;
+    int (*draw)(void *data, cairo_t *cr, int width, int height);
+    void *data;
+    void (*key_cb)(void *data, int code);
+    void *key_cb_data;
+    void (*idle_cb)(void *data);
+    void *idle_cb_data;
+    int width, height;                 // only accessed by x11win_conn_main after x11win_new
+    int pending_width, pending_height; // the last size from ConfigureNotify
+    int64_t resize_at;                 // when to apply the pending size, or 0 if it's the same
+    int64_t redraw_at;                 // when the draw callback asked to be called again, or 0
+    int64_t drawn_at;                  // when the draw callback was last called
+    bool resize_now;                   // whether to apply the pending size without waiting (x11win_set_size)
+    bool dirty, paint, closed, idle;
+    xcb_void_cookie_t ck_create, ck_name, ck_class, ck_hints; // checked by x11win_conn_main
+    unsigned int seq_deferred[2];                             // unchecked requests which x11win_conn_main reports errors for
 };
 
-static xcb_void_cookie_t xcbext_set_win_fixed_size_checked(xcb_connection_t *c, xcb_window_t window, uint32_t width, uint32_t height);
-static xcb_atom_t xcbext_get_intern_atom(xcb_connection_t *c, const char* name);
+static int64_t x11win_clock_us(void);
+static void x11win_resize(x11win_t *x);
+static double x11win_get_scale(xcb_screen_t *scr);
+
+static xcb_void_cookie_t xcbext_set_win_min_size_aspect(xcb_connection_t *c, xcb_window_t window, uint32_t width, uint32_t height, bool checked);
+static xcb_atom_t xcbext_get_intern_atom_reply(xcb_connection_t *c, xcb_intern_atom_cookie_t cookie);
 static xcb_visualtype_t *xcbext_get_visualtype(xcb_connection_t *c, xcb_visualid_t visualid);
 
-x11win_t *x11win_new(const char* title, const char* class, int width, int height, char **err) {
-    #define x11win_init_err(format, ...) do {         \
+// Every window request is sent up-front, then x11win_conn_main interns the
+// atoms last and waits for them, so the windows themselves only take a single
+// round trip however many there are (this makes a big difference over SSH or on
+// a busy server). Since the server processes requests in order, the errors for
+// every checked request will have been received along with the atoms, and
+// xcb_request_check doesn't need to sync for requests older than the last
+// reply, so the atoms must be interned after every checked request.
+//
+// The first cairo_xcb_surface_create on a connection also blocks while cairo
+// queries the RENDER version and formats, the SHM version, and whether SHM
+// works (a checked attach), which is a few more round trips (about 3 with
+// current versions of cairo) that can't be avoided without giving up those
+// extensions. It's done while creating the first window, before the atoms are
+// interned, so it doesn't affect the checks. x11win_conn_new prefetches the
+// extension and maximum request length replies cairo needs first, so they're
+// already on their way by then instead of taking their own round trips.
+
+x11win_conn_t *x11win_conn_new(char **err) {
+    #define x11win_conn_new_err(format, ...) do {     \
         if (format) {                                 \
             if (err)                                  \
                 asprintf(err, format, ##__VA_ARGS__); \
-            xcb_disconnect(x->conn);                  \
+            xcb_disconnect(c->conn);                  \
+            free(c);                                  \
             return NULL;                              \
         } else {                                      \
             if (err)                                  \
                 *err = NULL;                          \
-            return x;                                 \
+            return c;                                 \
         }                                             \
     } while (0)
 
-    x11win_t *x = calloc(1, sizeof(x11win_t));
+    x11win_conn_t *c = calloc(1, sizeof(x11win_conn_t));
 
     int errc;
-    xcb_generic_error_t *errx;
-    xcb_void_cookie_t ck;
 
-    x->width = width;
-    x->height = height;
+    c->timing = getenv("KBDSCR_TIMING") && *getenv("KBDSCR_TIMING");
+    c->t_start = x11win_clock_us();
 
-    x->conn = xcb_connect(NULL, NULL);
-    if ((errc = xcb_connection_has_error(x->conn)))
-        x11win_init_err("could not open display: %d", errc);
+    c->conn = xcb_connect(NULL, NULL);
+    if ((errc = xcb_connection_has_error(c->conn)))
+        x11win_conn_new_err("could not open display: %d", errc);
 
-    x->scr = xcb_setup_roots_iterator(xcb_get_setup(x->conn)).data;
-    if (!x->scr)
-        x11win_init_err("could not open screen");
+    c->t_connect = x11win_clock_us();
 
-    x->win = xcb_generate_id(x->conn);
+    // for cairo (see above)
+    xcb_prefetch_extension_data(c->conn, &xcb_render_id);
+    xcb_prefetch_extension_data(c->conn, &xcb_shm_id);
+    xcb_prefetch_maximum_request_length(c->conn);
 
-    ck = xcb_create_window_checked(
-        x->conn, XCB_COPY_FROM_PARENT, x->win, x->scr->root,
-        100, 100, x->width, x->height, 0,
-        XCB_COPY_FROM_PARENT, XCB_COPY_FROM_PARENT,
-        XCB_CW_BACK_PIXEL | XCB_CW_BACKING_STORE | XCB_CW_EVENT_MASK,
-        (uint32_t[]){x->scr->black_pixel, XCB_BACKING_STORE_WHEN_MAPPED, XCB_EVENT_MASK_EXPOSURE}
-    );
-    if ((errx = xcb_request_check(x->conn, ck)))
-        x11win_init_err("could not create window: %d", errx->error_code);
-    
-    ck = xcb_change_property_checked(x->conn, XCB_PROP_MODE_REPLACE, x->win, XCB_ATOM_WM_NAME, XCB_ATOM_STRING, 8, strlen(title), title);
-    if ((errx = xcb_request_check(x->conn, ck)))
-        x11win_init_err("could not set window name: %d", errx->error_code);
-    
-    ck = xcb_change_property_checked(x->conn, XCB_PROP_MODE_REPLACE, x->win, XCB_ATOM_WM_CLASS, XCB_ATOM_STRING, 8, strlen(class), class);
-    if ((errx = xcb_request_check(x->conn, ck)))
-        x11win_init_err("could not set window class: %d", errx->error_code);
-    
-    ck = xcbext_set_win_fixed_size_checked(x->conn, x->win, x->width, x->height);
-    if ((errx = xcb_request_check(x->conn, ck)))
-        x11win_init_err("could not set window size hints: %d", errx->error_code);
-
-    x->wmdel = xcbext_get_intern_atom(x->conn, "WM_DELETE_WINDOW");
-    ck = xcb_change_property_checked(x->conn, XCB_PROP_MODE_REPLACE, x->win, xcbext_get_intern_atom(x->conn, "WM_PROTOCOLS"), XCB_ATOM_ATOM, 32, 1, &x->wmdel);
-    if ((errx = xcb_request_check(x->conn, ck)))
-        x11win_init_err("could not set WM_PROTOCOLS: %d", errx->error_code);
-
-    ck = xcb_map_window_checked(x->conn, x->win);
-    if ((errx = xcb_request_check(x->conn, ck)))
-        x11win_init_err("could not create window: %d", errx->error_code);
-    
-    if (xcb_flush(x->conn) <= 0)
-        x11win_init_err("could not flush conn: %d", errx->error_code);
-
-    xcb_visualtype_t *vt = xcbext_get_visualtype(x->conn, x->scr->root_visual);
-    if (!vt)
-        x11win_init_err("could not get root screen visualtype");
-    x->s = cairo_xcb_surface_create(x->conn, x->win, vt, x->width, x->height);
-    x->cr = cairo_create(x->s);
+    c->scr = xcb_setup_roots_iterator(xcb_get_setup(c->conn)).data;
+    if (!c->scr)
+        x11win_conn_new_err("could not open screen");
+
+    c->vt = xcbext_get_visualtype(c->conn, c->scr->root_visual);
+    if (!c->vt)
+        x11win_conn_new_err("could not get root screen visualtype");
 
-    x11win_init_err(NULL);
-    #undef x11win_init_err
+    const char *scale = getenv("KBDSCR_SCALE");
+    if (scale && *scale) {
+        char *end;
+        c->scale = strtod(scale, &end);
+        if (*end || !(c->scale > 0))
+            x11win_conn_new_err("invalid KBDSCR_SCALE '%s'", scale);
+    } else {
+        c->scale = x11win_get_scale(c->scr);
+    }
+
+    x11win_conn_new_err(NULL);
+    #undef x11win_conn_new_err
 }
 
-int x11win_main(x11win_t *x, void (*draw)(void *data, cairo_t *s), void *data, char **err) {
-    #define x11win_main_err(format, ...) do {         \
+static x11win_t *x11win_conn_find(x11win_conn_t *c, xcb_window_t win) {
+    for (size_t i = 0; i < c->n_wins; i++)
+        if (c->wins[i]->win == win)
+            return c->wins[i];
+    return NULL;
+}
+
+int x11win_conn_main(x11win_conn_t *c, char **err) {
+    #define x11win_conn_main_err(format, ...) do {    \
         if (format) {                                 \
             if (err)                                  \
                 asprintf(err, format, ##__VA_ARGS__); \
-            xcb_disconnect(x->conn);                  \
             return 1;                                 \
         } else {                                      \
             if (err)                                  \
@@ -117,36 +162,279 @@ int x11win_main(x11win_t *x, void (*draw)(void *data, cairo_t *s), void *data, c
         }                                             \
     } while (0)
 
-    cairo_surface_t *bufs = cairo_surface_create_similar(x->s, CAIRO_CONTENT_COLOR, x->width, x->height);
+    x11win_t *x;
     cairo_t *bufcr;
 
+    int errc;
+    xcb_generic_error_t *errx;
+
+    // these must be sent after every checked request of every window (see
+    // above), or the first xcb_request_check would need another round trip
+    c->ck_wmdel = xcb_intern_atom(c->conn, 0, strlen("WM_DELETE_WINDOW"), "WM_DELETE_WINDOW");
+    c->ck_wmprotocols = xcb_intern_atom(c->conn, 0, strlen("WM_PROTOCOLS"), "WM_PROTOCOLS");
+
+    if ((c->wmdel = xcbext_get_intern_atom_reply(c->conn, c->ck_wmdel)) == XCB_ATOM_NONE)
+        x11win_conn_main_err("could not get WM_DELETE_WINDOW atom");
+    if ((c->wmprotocols = xcbext_get_intern_atom_reply(c->conn, c->ck_wmprotocols)) == XCB_ATOM_NONE)
+        x11win_conn_main_err("could not get WM_PROTOCOLS atom");
+
+    for (size_t i = 0; i < c->n_wins; i++) {
+        x = c->wins[i];
+
+        if ((errx = xcb_request_check(c->conn, x->ck_create)))
+            x11win_conn_main_err("could not create window: %d", errx->error_code);
+        if ((errx = xcb_request_check(c->conn, x->ck_name)))
+            x11win_conn_main_err("could not set window name: %d", errx->error_code);
+        if ((errx = xcb_request_check(c->conn, x->ck_class)))
+            x11win_conn_main_err("could not set window class: %d", errx->error_code);
+        if ((errx = xcb_request_check(c->conn, x->ck_hints)))
+            x11win_conn_main_err("could not set window size hints: %d", errx->error_code);
+
+        // checking these would need another round trip, so any errors are
+        // reported by the event loop instead
+        x->seq_deferred[0] = xcb_change_property(c->conn, XCB_PROP_MODE_REPLACE, x->win, c->wmprotocols, XCB_ATOM_ATOM, 32, 1, &c->wmdel).sequence;
+        x->seq_deferred[1] = xcb_map_window(c->conn, x->win).sequence;
+    }
+
+    if (xcb_flush(c->conn) <= 0)
+        x11win_conn_main_err("could not flush conn: %d", xcb_connection_has_error(c->conn));
+
+    c->t_windows = x11win_clock_us();
+
+    int64_t now;
+    size_t n_open;
+    bool painted;
+
     xcb_generic_event_t *evt;
+    xcb_generic_error_t *evt_error;
     xcb_expose_event_t *evt_expose;
+    xcb_configure_notify_event_t *evt_configure_notify;
+    xcb_key_press_event_t *evt_key_press;
     xcb_client_message_event_t *evt_client_message;
 
-    while ((evt = xcb_wait_for_event(x->conn))) {
-        switch (evt->response_type & ~0x80) {
-        case XCB_EXPOSE:
-            evt_expose = (xcb_expose_event_t*)(evt);
-            if (evt_expose->count != 0)
+    struct pollfd pfd = {
+        .fd     = xcb_get_file_descriptor(c->conn),
+        .events = POLLIN,
+    };
+
+    for (;;) {
+        // handle everything which has already arrived before drawing anything
+        while ((evt = xcb_poll_for_event(c->conn))) {
+            switch (evt->response_type & ~0x80) {
+            case 0:
+                evt_error = (xcb_generic_error_t*)(evt);
+                for (size_t i = 0; i < c->n_wins; i++) {
+                    for (int j = 0; j < 2; j++) {
+                        if (evt_error->full_sequence == c->wins[i]->seq_deferred[j]) {
+                            errc = evt_error->error_code;
+                            free(evt);
+                            x11win_conn_main_err("could not %s: %d", j ? "map window" : "set WM_PROTOCOLS", errc);
+                        }
+                    }
+                }
                 break;
-            bufcr = cairo_create(bufs);
-            draw(data, bufcr);
-            cairo_set_source_surface(x->cr, bufs, 0, 0);
-            cairo_paint(x->cr);
-            cairo_destroy(bufcr);
-            xcb_flush(x->conn);
-            break;
-        case XCB_CLIENT_MESSAGE:
-            evt_client_message = (xcb_client_message_event_t*)(evt);
-            if (evt_client_message->data.data32[0] == x->wmdel)
-                x11win_main_err(NULL);
-            break;
+            case XCB_EXPOSE:
+                evt_expose = (xcb_expose_event_t*)(evt);
+                if (!(x = x11win_conn_find(c, evt_expose->window)))
+                    break;
+                if (evt->response_type & 0x80)
+                    x->dirty = true; // sent by x11win_redraw
+                else if (evt_expose->count == 0)
+                    x->paint = true;
+                break;
+            case XCB_CONFIGURE_NOTIFY:
+                evt_configure_notify = (xcb_configure_notify_event_t*)(evt);
+                if (!(x = x11win_conn_find(c, evt_configure_notify->window)))
+                    break;
+                x->pending_width = evt_configure_notify->width;
+                x->pending_height = evt_configure_notify->height;
+                x->resize_at = (x->pending_width != x->width || x->pending_height != x->height)
+                    ? x11win_clock_us() + X11WIN_RESIZE_DEBOUNCE_MS*1000
+                    : 0;
+                break;
+            case XCB_KEY_PRESS:
+                evt_key_press = (xcb_key_press_event_t*)(evt);
+                if (!(x = x11win_conn_find(c, evt_key_press->event)))
+                    break;
+                if (x->key_cb)
+                    x->key_cb(x->key_cb_data, evt_key_press->detail - 8);
+                break;
+            case XCB_CLIENT_MESSAGE:
+                evt_client_message = (xcb_client_message_event_t*)(evt);
+                if (!(x = x11win_conn_find(c, evt_client_message->window)))
+                    break;
+                if (evt_client_message->data.data32[0] == c->wmdel) {
+                    xcb_unmap_window(c->conn, x->win);
+                    x->closed = true;
+                }
+                break;
+            }
+            free(evt);
+        }
+        if ((errc = xcb_connection_has_error(c->conn)))
+            x11win_conn_main_err("io error waiting for event: %d", errc);
+
+        now = x11win_clock_us();
+        n_open = 0;
+        painted = false;
+
+        int timeout = -1;
+        for (size_t i = 0; i < c->n_wins; i++) {
+            x = c->wins[i];
+            if (x->closed)
+                continue;
+            n_open++;
+
+            // until the size settles, the old contents are kept as-is
+            if (x->resize_now || (x->resize_at && now >= x->resize_at))
+                x11win_resize(x);
+
+            if (!x->bufs) {
+                x->bufs = cairo_surface_create_similar(x->s, CAIRO_CONTENT_COLOR, x->width, x->height);
+                x->dirty = true;
+            }
+
+            if (x->redraw_at && now >= x->redraw_at) {
+                x->redraw_at = 0;
+                x->dirty = true;
+            }
+
+            int64_t draw_at = 0;
+            if (x->dirty && now < x->drawn_at + X11WIN_FRAME_MS*1000) {
+                draw_at = x->drawn_at + X11WIN_FRAME_MS*1000;
+            } else if (x->dirty) {
+                // if the draw callback changes the size, the frame is thrown
+                // away and drawn again at the new size before it's shown
+                int ms;
+                do {
+                    if (x->resize_now)
+                        x11win_resize(x);
+                    bufcr = cairo_create(x->bufs);
+                    ms = x->draw(x->data, bufcr, x->width, x->height);
+                    cairo_destroy(bufcr);
+                } while (x->resize_now);
+                x->redraw_at = ms >= 0 ? now + (int64_t)(ms)*1000 : 0;
+                x->drawn_at = now;
+                x->dirty = false;
+                x->paint = true;
+            }
+
+            if (x->paint) {
+                cairo_set_source_surface(x->cr, x->bufs, 0, 0);
+                cairo_paint(x->cr);
+                cairo_surface_flush(x->s);
+                x->paint = false;
+                x->idle = true;
+                painted = true;
+            }
+
+            for (int j = 0; j < 3; j++) {
+                int64_t at = (int64_t[]){x->resize_at, x->redraw_at, draw_at}[j];
+                if (at) {
+                    int t = at > now ? (at - now + 999)/1000 : 0;
+                    if (timeout == -1 || t < timeout)
+                        timeout = t;
+                }
+            }
         }
+
+        if (painted) {
+            xcb_flush(c->conn);
+            if (c->timing) {
+                now = x11win_clock_us();
+                printf("Timing: connect %.1fms, surfaces %.1fms, windows %.1fms (%zu), first frame %.1fms.\n",
+                    (c->t_connect - c->t_start)/1000.0,
+                    c->t_surfaces/1000.0,
+                    (c->t_windows - c->t_connect - c->t_surfaces)/1000.0, c->n_wins,
+                    (now - c->t_start)/1000.0);
+                c->timing = false;
+            }
+
+            // anything else can be done now that the frames are on their way
+            for (size_t i = 0; i < c->n_wins; i++) {
+                x = c->wins[i];
+                if (x->idle && x->idle_cb)
+                    x->idle_cb(x->idle_cb_data);
+                x->idle = false;
+            }
+        }
+
+        if (!n_open)
+            x11win_conn_main_err(NULL);
+
+        if (poll(&pfd, 1, timeout) == -1 && errno != EINTR)
+            x11win_conn_main_err("wait for event: %s", strerror(errno));
     }
-    x11win_main_err(evt ? NULL : "io error waiting for event");
 
-    #undef x11win_main_err
+    #undef x11win_conn_main_err
+}
+
+void x11win_conn_free(x11win_conn_t *c) {
+    assert(!c->n_wins);
+    xcb_disconnect(c->conn);
+    free(c->wins);
+    free(c);
+}
+
+x11win_t *x11win_new(x11win_conn_t *c, const char* title, const char* class, int width, int height, int (*draw)(void *data, cairo_t *cr, int width, int height), void *data, char **err) {
+    x11win_t *x = calloc(1, sizeof(x11win_t));
+    x->c = c;
+    x->draw = draw;
+    x->data = data;
+
+    x->width = x->pending_width = round(width * c->scale);
+    x->height = x->pending_height = round(height * c->scale);
+
+    x->win = xcb_generate_id(c->conn);
+
+    x->ck_create = xcb_create_window_checked(
+        c->conn, XCB_COPY_FROM_PARENT, x->win, c->scr->root,
+        100, 100, x->width, x->height, 0,
+        XCB_COPY_FROM_PARENT, XCB_COPY_FROM_PARENT,
+        XCB_CW_BACK_PIXEL | XCB_CW_BACKING_STORE | XCB_CW_EVENT_MASK,
+        (uint32_t[]){c->scr->black_pixel, XCB_BACKING_STORE_WHEN_MAPPED, XCB_EVENT_MASK_EXPOSURE | XCB_EVENT_MASK_STRUCTURE_NOTIFY | XCB_EVENT_MASK_KEY_PRESS}
+    );
+    x->ck_name = xcb_change_property_checked(c->conn, XCB_PROP_MODE_REPLACE, x->win, XCB_ATOM_WM_NAME, XCB_ATOM_STRING, 8, strlen(title), title);
+    x->ck_class = xcb_change_property_checked(c->conn, XCB_PROP_MODE_REPLACE, x->win, XCB_ATOM_WM_CLASS, XCB_ATOM_STRING, 8, strlen(class), class);
+    x->ck_hints = xcbext_set_win_min_size_aspect(c->conn, x->win, width, height, true);
+
+    int64_t t = x11win_clock_us();
+    x->s = cairo_xcb_surface_create(c->conn, x->win, c->vt, x->width, x->height);
+    c->t_surfaces += x11win_clock_us() - t;
+    x->cr = cairo_create(x->s);
+
+    c->wins = realloc(c->wins, (c->n_wins + 1) * sizeof(x11win_t*));
+    c->wins[c->n_wins++] = x;
+
+    if (err)
+        *err = NULL;
+    return x;
+}
+
+void x11win_set_key_cb(x11win_t *x, void (*fn)(void *data, int code), void *data) {
+    x->key_cb = fn;
+    x->key_cb_data = data;
+}
+
+void x11win_set_idle_cb(x11win_t *x, void (*fn)(void *data), void *data) {
+    x->idle_cb = fn;
+    x->idle_cb_data = data;
+}
+
+void x11win_set_size(x11win_t *x, int width, int height, double scale) {
+    x11win_conn_t *c = x->c;
+
+    // the hints need to be changed first, or the window manager might not allow
+    // the new size
+    xcbext_set_win_min_size_aspect(c->conn, x->win, width, height, false);
+    x->pending_width = round(width * scale);
+    x->pending_height = round(height * scale);
+    xcb_configure_window(c->conn, x->win, XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT, (uint32_t[]){x->pending_width, x->pending_height});
+    xcb_flush(c->conn);
+
+    // the new size is used straight away without waiting for the window manager
+    // (if it chooses a different size, it'll be handled like any other resize)
+    x->resize_now = true;
 }
 
 void x11win_redraw(x11win_t *x) {
@@ -154,19 +442,56 @@ void x11win_redraw(x11win_t *x) {
     xcb_expose_event_t *evt = (xcb_expose_event_t*)(&(xcb_raw_generic_event_t){});
     evt->response_type = XCB_EXPOSE;
     evt->window = x->win;
-    evt->width = x->width;
-    evt->height = x->height;
-    xcb_send_event(x->conn, false, x->win, XCB_EVENT_MASK_EXPOSURE, (char*)(evt));
-    xcb_flush(x->conn);
+    xcb_send_event(x->c->conn, false, x->win, XCB_EVENT_MASK_EXPOSURE, (char*)(evt));
+    xcb_flush(x->c->conn);
 }
 
 void x11win_free(x11win_t *x) {
+    x11win_conn_t *c = x->c;
+    for (size_t i = 0; i < c->n_wins; i++) {
+        if (c->wins[i] == x) {
+            c->wins[i] = c->wins[--c->n_wins];
+            break;
+        }
+    }
+    if (x->bufs)
+        cairo_surface_destroy(x->bufs);
+    cairo_destroy(x->cr);
     cairo_surface_destroy(x->s);
-    xcb_disconnect(x->conn);
+    xcb_destroy_window(c->conn, x->win);
     free(x);
 }
 
-static xcb_void_cookie_t xcbext_set_win_fixed_size_checked(xcb_connection_t *c, xcb_window_t window, uint32_t width, uint32_t height) {
+// x11win_resize applies the pending size, replacing the buffer.
+static void x11win_resize(x11win_t *x) {
+    x->resize_now = false;
+    x->resize_at = 0;
+    x->width = x->pending_width;
+    x->height = x->pending_height;
+    cairo_destroy(x->cr);
+    cairo_xcb_surface_set_size(x->s, x->width, x->height);
+    x->cr = cairo_create(x->s);
+    cairo_surface_destroy(x->bufs);
+    x->bufs = cairo_surface_create_similar(x->s, CAIRO_CONTENT_COLOR, x->width, x->height);
+    x->dirty = true;
+}
+
+static int64_t x11win_clock_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)(ts.tv_sec)*1000000 + ts.tv_nsec/1000;
+}
+
+static double x11win_get_scale(xcb_screen_t *scr) {
+    // X11 doesn't have a real concept of HiDPI scaling, so guess it from the
+    // physical size of the screen, rounded to a multiple of 96 DPI
+    if (!scr->width_in_millimeters)
+        return 1;
+    double scale = round(scr->width_in_pixels * 25.4 / scr->width_in_millimeters / 96);
+    return scale < 1 ? 1 : scale;
+}
+
+static xcb_void_cookie_t xcbext_set_win_min_size_aspect(xcb_connection_t *c, xcb_window_t window, uint32_t width, uint32_t height, bool checked) {
     // https://cgit.freedesktop.org/xcb/util-wm/tree/icccm/xcb_icccm.h?id=177d933f04d822deb7ec0a7bb13148701eec3e55#n527
     struct {
         uint32_t flags;
@@ -180,17 +505,19 @@ static xcb_void_cookie_t xcbext_set_win_fixed_size_checked(xcb_connection_t *c,
         uint32_t win_gravity;
     } hints = {0};
 
-    hints.flags = (1<<4) + (1<<5); // P_MIN_SIZE | P_MAX_SIZE
+    hints.flags = (1<<4) + (1<<7); // P_MIN_SIZE | P_ASPECT
     hints.min_width = width;
     hints.min_height = height;
-    hints.max_width = width;
-    hints.max_height = height;
+    hints.min_aspect_num = hints.max_aspect_num = width;
+    hints.min_aspect_den = hints.max_aspect_den = height;
 
-    return xcb_change_property_checked(c, XCB_PROP_MODE_REPLACE, window, XCB_ATOM_WM_NORMAL_HINTS, XCB_ATOM_WM_SIZE_HINTS, 32, sizeof(hints)>>2, &hints);
+    return (checked ? xcb_change_property_checked : xcb_change_property)(c, XCB_PROP_MODE_REPLACE, window, XCB_ATOM_WM_NORMAL_HINTS, XCB_ATOM_WM_SIZE_HINTS, 32, sizeof(hints)>>2, &hints);
 }
 
-static xcb_atom_t xcbext_get_intern_atom(xcb_connection_t *c, const char* name) {
-    xcb_intern_atom_reply_t *r = xcb_intern_atom_reply(c, xcb_intern_atom_unchecked(c, 1, strlen(name), name), NULL);
+static xcb_atom_t xcbext_get_intern_atom_reply(xcb_connection_t *c, xcb_intern_atom_cookie_t cookie) {
+    xcb_intern_atom_reply_t *r = xcb_intern_atom_reply(c, cookie, NULL);
+    if (!r)
+        return XCB_ATOM_NONE;
     xcb_atom_t a = r->atom;
     free(r);
     return a;
@@ -2,23 +2,64 @@
 #define KBDSCR_WIN_H
 #include <cairo/cairo.h>
 
+// x11win_conn_t is a connection to the X server, which runs the event loop for
+// all of the windows created on it.
+typedef struct x11win_conn_t x11win_conn_t;
+
 // x11win_t is a simple wrapper for using cairo with an XCB window.
 typedef struct x11win_t x11win_t;
 
-// x11win_new creates a new window with the specified title and a fixed size. If
-// any errors ocurred, the return value will be NULL, and if err is not NULL,
-// its target will be set to a string describing the error (which will need to
-// be freed by the caller). Otherwise, the return value will be an allocated
-// x11win_t.
-x11win_t *x11win_new(const char* title, const char* class, int width, int height, char **err);
+// x11win_conn_new connects to the X server. If any errors ocurred, the return
+// value will be NULL, and if err is not NULL, its target will be set to a string
+// describing the error (which will need to be freed by the caller). Otherwise,
+// the return value will be an allocated x11win_conn_t.
+x11win_conn_t *x11win_conn_new(char **err);
+
+// x11win_conn_main shows the windows and runs the main event loop for them. It
+// returns when all of them have been closed with WM_DELETE_WINDOW. It also
+// returns any error which occurs (including ones from creating the windows,
+// which aren't waited for by x11win_new).
+int x11win_conn_main(x11win_conn_t *c, char **err);
+
+// x11win_conn_free disconnects from the X server. All windows must have been
+// freed first.
+void x11win_conn_free(x11win_conn_t *c);
 
-// x11win_main runs the main event loop for the window and returns when the
-// WM_DELETE_WINDOW is sent. It also returns any error which occurs.
-int x11win_main(x11win_t *x, void (*draw)(void *data, cairo_t *s), void *data, char **err);
+// x11win_new creates a new resizable window with the specified title. The width
+// and height are the natural size of the contents, which is used as the minimum
+// size and aspect ratio, and is multiplied by the display scale (KBDSCR_SCALE
+// if set, otherwise guessed from the DPI of the screen) for the initial size.
+// The draw callback is called from x11win_conn_main with the current size of
+// the window whenever it is resized (once the size stops changing) or
+// x11win_redraw is called (at most once per frame), and returns the number of
+// milliseconds after which it needs to be called again, or -1. If any errors
+// ocurred, the return value will be NULL, and if err is not NULL, its target
+// will be set to a string describing the error (which will need to be freed by
+// the caller). Otherwise, the return value will be an allocated x11win_t.
+x11win_t *x11win_new(x11win_conn_t *c, const char* title, const char* class, int width, int height, int (*draw)(void *data, cairo_t *cr, int width, int height), void *data, char **err);
 
 // x11win_free destroys the window and any allocated resources.
 void x11win_free(x11win_t *x);
 
+// x11win_set_key_cb sets the callback to be called with the KEY_* code (i.e.
+// the X keycode minus 8, which is how the evdev and libinput X drivers map
+// them) when a key is pressed while the window is focused. It is called from
+// x11win_conn_main.
+void x11win_set_key_cb(x11win_t *x, void (*fn)(void *data, int code), void *data);
+
+// x11win_set_idle_cb sets the callback to be called from x11win_conn_main after
+// a new frame of the window has been sent to the X server, for work which
+// shouldn't delay the frame.
+void x11win_set_idle_cb(x11win_t *x, void (*fn)(void *data), void *data);
+
+// x11win_set_size changes the natural size of the contents (like x11win_new)
+// and resizes the window to it multiplied by scale. The next frame is drawn at
+// the new size without waiting for the window manager to resize the window. If
+// it is called from the draw callback, the frame it drew is discarded, and the
+// callback is called again at the new size before anything is shown (so it
+// must not change the size again). It must only be called from the callbacks.
+void x11win_set_size(x11win_t *x, int width, int height, double scale);
+
 // x11win_redraw forces the window to be redrawn. It can be safely called from
 // another thread.
 void x11win_redraw(x11win_t *x);